@@ -0,0 +1,73 @@
+#include "ast.h"
+#include "errors.h"
+
+#include <cstdlib>
+#include <cstring>
+
+struct NODE *nodes = nullptr;
+unsigned int nodeCount = 1;
+unsigned int freeNodeCount = 0;
+
+struct for_loop *forLoops = nullptr;
+
+static unsigned int nodeCapacity = 0;
+static node_t freeNodes = 0;
+static unsigned int forLoopCount = 0;
+
+/**
+ * Allocates a new node in the arena, with all its fields cleared
+ * @param type Type of the new node
+ * @return Index of the new node, which is never 0
+ */
+node_t newNode(enum etype type) {
+    node_t index;
+
+    if (freeNodes) {
+        // Reuse a node that was freed again
+        index = freeNodes;
+        freeNodes = nodes[index].next;
+        freeNodeCount--;
+    } else {
+        if (nodeCount >= nodeCapacity) {
+            if (nodeCapacity == MAX_NODES) memoryError();
+
+            nodeCapacity = nodeCapacity ? nodeCapacity * 2 : 64;
+            if (nodeCapacity > MAX_NODES) nodeCapacity = MAX_NODES;
+
+            nodes = (struct NODE *) realloc(nodes, nodeCapacity * sizeof(struct NODE));
+            if (nodes == nullptr) memoryError();
+        }
+
+        index = nodeCount++;
+    }
+
+    memset(&nodes[index], 0, sizeof(struct NODE));
+    nodes[index].data.type = type;
+
+    return index;
+}
+
+/**
+ * Gives a node back to the arena, it will be reused by the next call to newNode()
+ * @param index Index of the node, which should not be referenced anymore
+ */
+void freeNode(node_t index) {
+    nodes[index].next = freeNodes;
+    freeNodes = index;
+    freeNodeCount++;
+}
+
+/**
+ * Reserves the state of a new For( loop. The loops don't need a stack, as a loop can't be entered again while it is
+ * running, so jumping out of one never leaves anything behind.
+ * @return Index of the loop in forLoops[]
+ */
+unsigned int newForLoop() {
+    forLoops = (struct for_loop *) realloc(forLoops, (forLoopCount + 1) * sizeof(struct for_loop));
+    if (forLoops == nullptr) memoryError();
+
+    // Until the loop is entered, reaching its End (with a Goto) just continues after it
+    forLoops[forLoopCount].var = nullptr;
+
+    return forLoopCount++;
+}
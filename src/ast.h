@@ -3,9 +3,12 @@
 
 #include "types.h"
 
-enum etype {
+struct var_real;
+
+enum etype : uint8_t {
     ET_NUMBER,
     ET_COMPLEX,
+    ET_STRING_LITERAL,
     ET_VARIABLE,
 
     ET_STRING,
@@ -16,11 +19,96 @@ enum etype {
 
     ET_MATRIX,
 
+    ET_ANS,
+
+    ET_LIST_ELEMENT,    // An element of an OS list or matrix, like L1(I) or [A](R,C). The children are the indices.
+    ET_MATRIX_ELEMENT,
+
     ET_OPERATOR,
+    ET_FUSED,           // Element-wise operators on lists, which are evaluated in a single loop
     ET_FUNCTION_CALL,   // The difference between a function call and a command is that a function call can be used in
-    ET_COMMAND          // an expression, whereas a command should be the first token on a line.
+    ET_COMMAND,         // an expression, whereas a command should be the first token on a line.
+    ET_CONTROL          // A statement which can continue at another statement than the next one, like Goto
+};
+
+/**
+ * All nodes live in a single arena, and refer to each other by their index in it. Index 0 is never used, so it means
+ * "no node". As the arena can move when it grows, never keep a pointer to a node across a call to newNode().
+ */
+typedef uint16_t node_t;
+
+// Operators are resolved to their handler when parsing, so evaluating them doesn't need any lookup
+struct op_t {
+    uint8_t token;
+    uint8_t precedence;
+    bool real;              // Both operands are inferred to be real numbers, see inferTypes()
+    union {
+        UnaryOperator *unary;
+        BinaryOperator *binary;
+    } handler;              // nullptr if the operator can't be evaluated
+};
+
+struct func_t {
+    uint16_t token;
+    uint8_t argc;
+    UnaryFunction *handler; // Only set for known functions with a single argument
+};
+
+/**
+ * An element-wise expression over lists, like L1*2+L2-1. The children of the node are the leaves of the expression,
+ * which are evaluated first, and code is the expression in postfix order: FUSED_LEAF takes the next leaf, and every
+ * other byte is the token of the operator which is applied. This way, no list is allocated for intermediate results.
+ */
+#define FUSED_LEAF 0
+#define FUSED_MAX_LEAVES 8
+#define FUSED_MAX_DEPTH 8
+#define FUSED_MAX_LENGTH 24
+
+struct fused_expr {
+    uint8_t leaves;
+    uint8_t length;
+    uint8_t code[];
 };
 
+/**
+ * Control flow is not nested in the tree: the program is always a single list of statements, and a control statement
+ * refers to the statement to continue at. This way, a Goto can jump anywhere without having to unwind anything. The
+ * target of each control statement is:
+ *  - If: the last statement which is skipped if the condition is false, which is Else or End for a Then-block
+ *  - Else: End of the If-statement
+ *  - While/Repeat/For(: its End
+ *  - End: the statement which opened the block
+ *  - Goto: its Lbl, or 0 if that label doesn't exist
+ * The condition of If/While/Repeat is the child of the statement, and For( has the variable, start, end and
+ * optionally the step as children.
+ */
+struct control_t {
+    uint8_t token;
+    node_t target;
+    union {
+        uint16_t label;     // Lbl and Goto: name of the label, only used while parsing
+        uint16_t loop;      // For(: index of the loop in forLoops[]
+    };
+};
+
+/**
+ * State of a For( loop. The end and step are only evaluated once, when the loop is entered. If the start, end and step
+ * are all small integers, the loop counts with an int, and the float in the variable is only written, not read. As
+ * soon as the body stores something else in the variable, the loop continues with floats.
+ */
+struct for_loop {
+    struct var_real *var;   // The loop variable, or nullptr if the loop was never entered
+    float end;
+    float step;
+    bool integer;
+    int intCounter;
+    int intEnd;
+    int intStep;
+    uint32_t counterBits;   // The float which was last stored in the variable by the loop
+};
+
+extern struct for_loop *forLoops;
+
 union operand_t {
     // OS variables
     uint8_t variableNr;
@@ -31,12 +119,16 @@ union operand_t {
     uint8_t matrixNr;
 
     // Internal
-    uint8_t op;
-    unsigned int func;
+    struct op_t op;
+    struct func_t func;
     unsigned int command;
+    struct control_t control;
+    struct fused_expr *fused;
 
-    Number *num;
-    Complex *cplx;
+    // Literals are stored in the node itself. Complex literals are always purely imaginary, like "3i", so only the
+    // imaginary part is stored, in num as well.
+    float num;
+    struct var_string *string;
 };
 
 struct element_t {
@@ -44,10 +136,27 @@ struct element_t {
     union operand_t operand;
 };
 
+// The arena can hold at most this many nodes, including the unused node 0
+#define MAX_NODES 0x10000
+
 struct NODE {
-    struct NODE *next;
-    struct NODE *child;
+    node_t next;
+    node_t child;
     struct element_t data;
 };
 
+extern struct NODE *nodes;
+extern unsigned int nodeCount;
+extern unsigned int freeNodeCount;
+
+static inline struct NODE *getNode(node_t index) {
+    return &nodes[index];
+}
+
+node_t newNode(enum etype type);
+
+void freeNode(node_t index);
+
+unsigned int newForLoop();
+
 #endif
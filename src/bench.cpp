@@ -0,0 +1,101 @@
+#include "bench.h"
+
+#ifdef BENCH_MATRIX
+
+#include "types.h"
+#include "utils.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fontlibc.h>
+
+#define BENCH_MIN_SIZE 2
+#define BENCH_MAX_SIZE 30
+
+// Every size does about this many multiplications, so the small ones are repeated enough to be measured
+#define BENCH_MULTIPLICATIONS 4000UL
+
+// The multiplication before it was moved to i-k-j order, as the reference for both the timing and the results
+static void multiplyMatricesOld(Matrix &result, const Matrix &lhs, const Matrix &rhs) {
+    float *out = result.elements;
+
+    for (uint8_t i = 0; i < lhs.rows; i++) {
+        const float *lhsRow = &lhs.elements[i * lhs.cols];
+
+        for (uint8_t j = 0; j < rhs.cols; j++) {
+            const float *rhsCol = &rhs.elements[j];
+            float sum = 0;
+
+            for (uint8_t k = 0; k < lhs.cols; k++) {
+                sum += lhsRow[k] * *rhsCol;
+                rhsCol += rhs.cols;
+            }
+
+            *out++ = sum;
+        }
+    }
+}
+
+static unsigned long ticksToUs(clock_t ticks, unsigned long repeats) {
+    // CLOCKS_PER_SEC is 32768 on the CE, so use 64 bits to not overflow
+    return (unsigned long) ((unsigned long long) ticks * 1000000 / CLOCKS_PER_SEC / repeats);
+}
+
+// Random elements with 2 decimals, some of them 0 like in geometry matrices
+static void fillMatrix(Matrix &matrix) {
+    for (unsigned int i = 0; i < matrix.size(); i++) {
+        matrix.elements[i] = rand() % 8 ? (float) (rand() % 2000 - 1000) / 100 : 0;
+    }
+}
+
+/**
+ * Multiplies random square matrices of every size from 2 to 30 with both the old and the current loop, and shows the
+ * time per multiplication in microseconds. The summation order is the same, so the results should be bit-identical.
+ */
+void benchmarkMatrices() {
+    char buf[27];
+
+    srand(1);
+    fontlib_Newline();
+    fontlib_DrawString("Size Old (us) New (us)");
+
+    for (uint8_t size = BENCH_MIN_SIZE; size <= BENCH_MAX_SIZE; size++) {
+        Matrix *lhs = Matrix::create(size, size);
+        Matrix *rhs = Matrix::create(size, size);
+        Matrix *oldResult = Matrix::create(size, size);
+        Matrix *newResult = Matrix::create(size, size);
+        unsigned long cube = (unsigned long) size * size * size;
+        unsigned long repeats = cube < BENCH_MULTIPLICATIONS ? BENCH_MULTIPLICATIONS / cube : 1;
+
+        fillMatrix(*lhs);
+        fillMatrix(*rhs);
+
+        clock_t start = clock();
+        for (unsigned long i = 0; i < repeats; i++) {
+            multiplyMatricesOld(*oldResult, *lhs, *rhs);
+        }
+        clock_t oldTime = clock() - start;
+
+        start = clock();
+        for (unsigned long i = 0; i < repeats; i++) {
+            multiplyMatricesInto(*newResult, *lhs, *rhs);
+        }
+        clock_t newTime = clock() - start;
+
+        bool same = !memcmp(oldResult->elements, newResult->elements, oldResult->size() * sizeof(float));
+
+        fontlib_Newline();
+        sprintf(buf, "%4u%9lu%9lu%s", size, ticksToUs(oldTime, repeats), ticksToUs(newTime, repeats),
+                same ? "" : " !=");
+        fontlib_DrawString(buf);
+
+        release(lhs);
+        release(rhs);
+        release(oldResult);
+        release(newResult);
+    }
+}
+
+#endif
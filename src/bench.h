@@ -0,0 +1,16 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Build with "make CXXFLAGS+=-DBENCH_MATRIX" to time the matrix multiplication against the old i-j-k loop after the
+// program has finished. Without it, this compiles to nothing.
+#ifdef BENCH_MATRIX
+
+void benchmarkMatrices();
+
+#else
+
+static inline void benchmarkMatrices() {}
+
+#endif
+
+#endif
@@ -1,6 +1,9 @@
 #include "commands.h"
 #include "ast.h"
+#include "errors.h"
 #include "evaluate.h"
+#include "format.h"
+#include "functions.h"
 #include "main.h"
 
 #include <cstdio>
@@ -9,35 +12,26 @@
 #include <tice.h>
 #include <ti/tokens.h>
 
-void commandDisp(struct NODE *node) {
+static void commandDisp(Value *args, unsigned int argc) {
     static char buf[27] = {0};
 
-    while (node != nullptr) {
-        BaseType *result = evalNode(node);
+    for (unsigned int i = 0; i < argc; i++) {
+        Value &result = args[i];
 
-        if (result != nullptr) {
-            if (result->type() == TypeType::MATRIX) {
+        if (result.type != TypeType::NONE) {
+            if (result.type == TypeType::MATRIX) {
                 uint8_t maxColLengths[12] = {0};
 
-                auto elements = dynamic_cast<Matrix &>(*result).elements;
+                const Matrix &matrix = *result.matrix;
 
                 // Get the max lengths of each column, 12 max
-                unsigned int rowIndex = 0;
-                for (auto &row: elements) {
-                    unsigned int colIndex = 0;
-
-                    for (auto &col: row) {
-                        char *out = col.toString();
+                for (uint8_t row = 0; row < matrix.rows && row < 10; row++) {
+                    for (uint8_t col = 0; col < matrix.cols && col < 12; col++) {
+                        char *out = formatNum(matrix.at(row, col));
                         uint24_t length = strlen(out);
 
-                        if (length > maxColLengths[colIndex]) maxColLengths[colIndex] = length;
-                        colIndex++;
-
-                        if (colIndex >= 12) break;
+                        if (length > maxColLengths[col]) maxColLengths[col] = length;
                     }
-
-                    rowIndex++;
-                    if (rowIndex >= 10) break;
                 }
 
                 // Get the total width of all columns combined
@@ -57,22 +51,20 @@ void commandDisp(struct NODE *node) {
                 fontlib_DrawString("\xC1");
 
                 // Display each column
-                rowIndex = 0;
-                for (auto &row: elements) {
-                    unsigned int colIndex = 0;
+                unsigned int rowIndex = 0;
+                for (uint8_t row = 0; row < matrix.rows; row++) {
                     unsigned int cumSumColX = beginWidth + 2;
 
                     fontlib_SetCursorPosition((beginWidth + 1) * GLYPH_WIDTH + HOMESCREEN_X, fontlib_GetCursorY());
                     fontlib_DrawString("\xC1");
 
                     // Display a space to leave space for the big bracket
-                    for (auto &col: row) {
-                        char *out = col.toString();
+                    for (uint8_t col = 0; col < matrix.cols; col++) {
+                        char *out = formatNum(matrix.at(row, col));
 
                         fontlib_SetCursorPosition(cumSumColX * GLYPH_WIDTH + HOMESCREEN_X, fontlib_GetCursorY());
                         fontlib_DrawString(out);
-                        cumSumColX += maxColLengths[colIndex] + 1;
-                        colIndex++;
+                        cumSumColX += maxColLengths[col] + 1;
 
                         if (cumSumColX >= 26) break;
                     }
@@ -81,17 +73,17 @@ void commandDisp(struct NODE *node) {
                     rowIndex++;
                     fontlib_DrawString("]");
 
-                    if (rowIndex == elements.size()) fontlib_DrawString("]");
-                    if (rowIndex == 10 && elements.size() != 10) fontlib_DrawString("\x1F");
+                    if (rowIndex == matrix.rows) fontlib_DrawString("]");
+                    if (rowIndex == 10 && matrix.rows != 10) fontlib_DrawString("\x1F");
 
                     fontlib_Newline();
 
                     if (rowIndex >= 10) break;
                 }
             } else {
-                char *out = result->toString();
+                char *out = result.toString();
 
-                if (result->type() == TypeType::STRING) {
+                if (result.type == TypeType::STRING) {
                     fontlib_DrawStringL(out, 26);
                 } else {
                     sprintf(buf, "%26s", out);
@@ -99,17 +91,26 @@ void commandDisp(struct NODE *node) {
                 }
                 fontlib_Newline();
             }
-
-            delete result;
         }
-
-        // Get the next child
-        node = node->next;
     }
 }
 
+void runCommand(unsigned int command, Value *args, unsigned int argc) {
+    if (command == OS_TOK_DISP) commandDisp(args, argc);
+
+    // A Goto to a label that doesn't exist is compiled as a command, as there is nothing to jump to
+    else if (command == OS_TOK_GOTO) labelError();
+}
+
 void evalCommand(struct NODE *node) {
-    unsigned int command = node->data.operand.command;
+    Value args[MAX_ARGS];
+    unsigned int argc = 0;
+
+    for (node_t tmp = node->child; tmp; tmp = getNode(tmp)->next) {
+        if (argc == MAX_ARGS) argumentsError();
+
+        args[argc++] = evalNode(getNode(tmp));
+    }
 
-    if (command == OS_TOK_DISP) commandDisp(node->child);
+    runCommand(node->data.operand.command, args, argc);
 }
@@ -3,6 +3,8 @@
 
 #include "ast.h"
 
+void runCommand(unsigned int command, Value *args, unsigned int argc);
+
 void evalCommand(struct NODE *func_node);
 
 #endif
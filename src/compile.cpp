@@ -0,0 +1,391 @@
+#include "compile.h"
+#include "ast.h"
+#include "errors.h"
+#include "operators.h"
+#include "variables.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <ti/tokens.h>
+
+// A jump whose address can only be filled in when the whole program is compiled, as its target might come later
+struct fixup {
+    unsigned int position;
+    node_t target;
+};
+
+static uint8_t *code;
+static unsigned int codeSize;
+static unsigned int codeCapacity;
+static unsigned int stackDepth;
+
+// Start of the code of each statement, indexed by node. Node 0 means the end of the program.
+static unsigned int *offsets;
+static struct fixup *fixups;
+static unsigned int fixupCount;
+static unsigned int fixupCapacity;
+
+static void compileNode(struct NODE *node);
+
+static void emit(const void *data, unsigned int size) {
+    if (codeSize + size > codeCapacity) {
+        codeCapacity = codeCapacity * 2 + size;
+        code = (uint8_t *) realloc(code, codeCapacity);
+
+        if (code == nullptr) memoryError();
+    }
+
+    memcpy(code + codeSize, data, size);
+    codeSize += size;
+}
+
+template<typename T>
+static void emitOperand(T value) {
+    emit(&value, sizeof(T));
+}
+
+static void emitOpcode(enum opcode opcode) {
+    emitOperand<uint8_t>(opcode);
+}
+
+static void push() {
+    if (++stackDepth > VALUE_STACK_SIZE) memoryError();
+}
+
+static void pop(unsigned int amount) {
+    stackDepth -= amount;
+}
+
+/**
+ * Emits the address of a statement, which is filled in at the end of compileProgram()
+ * @param target Statement to jump to, or 0 to jump to the end of the program
+ */
+static void emitTarget(node_t target) {
+    if (fixupCount == fixupCapacity) {
+        fixupCapacity = fixupCapacity ? fixupCapacity * 2 : 8;
+        fixups = (struct fixup *) realloc(fixups, fixupCapacity * sizeof(struct fixup));
+
+        if (fixups == nullptr) memoryError();
+    }
+
+    fixups[fixupCount++] = {codeSize, target};
+    emitOperand<const uint8_t *>(nullptr);
+}
+
+static void emitJump(enum opcode opcode, node_t target) {
+    emitOpcode(opcode);
+    emitTarget(target);
+}
+
+/**
+ * Emits a condition, followed by a jump which removes it from the stack again
+ * @param condition Expression to test
+ * @param opcode OC_JUMP_IF_FALSE or OC_JUMP_IF_TRUE
+ * @param target Statement to jump to
+ */
+static void emitConditionalJump(node_t condition, enum opcode opcode, node_t target) {
+    compileNode(getNode(condition));
+    emitJump(opcode, target);
+    pop(1);
+}
+
+static void compileEnd(struct NODE *block) {
+    const struct control_t &control = block->data.operand.control;
+
+    switch (control.token) {
+        case OS_TOK_WHILE:
+            // The condition is tested again at the end, so each iteration only needs a single jump
+            emitConditionalJump(block->child, OC_JUMP_IF_TRUE, block->next);
+            break;
+
+        case OS_TOK_REPEAT:
+            emitConditionalJump(block->child, OC_JUMP_IF_FALSE, block->next);
+            break;
+
+        case OS_TOK_FOR:
+            emitOpcode(OC_FOR_NEXT);
+            emitOperand<struct for_loop *>(&forLoops[control.loop]);
+            emitTarget(block->next);
+            break;
+
+        default:
+            // The End of an If-statement is only a target to jump to
+            break;
+    }
+}
+
+static void compileControl(struct NODE *node) {
+    const struct control_t &control = node->data.operand.control;
+
+    switch (control.token) {
+        case OS_TOK_IF:
+        case OS_TOK_WHILE:
+            emitConditionalJump(node->child, OC_JUMP_IF_FALSE, getNode(control.target)->next);
+            break;
+
+        case OS_TOK_ELSE:
+            emitJump(OC_JUMP, getNode(control.target)->next);
+            break;
+
+        case OS_TOK_FOR: {
+            node_t start = getNode(node->child)->next;
+            node_t end = getNode(start)->next;
+            node_t step = getNode(end)->next;
+
+            compileNode(getNode(start));
+            compileNode(getNode(end));
+            if (step) {
+                compileNode(getNode(step));
+            } else {
+                emitOpcode(OC_NUMBER);
+                emitOperand<Number>(Number::fromInt(1));
+                push();
+            }
+
+            emitOpcode(OC_FOR_ENTER);
+            emitOperand<uint8_t>(getNode(node->child)->data.operand.variableNr);
+            emitOperand<struct for_loop *>(&forLoops[control.loop]);
+            emitTarget(getNode(control.target)->next);
+            pop(3);
+            break;
+        }
+
+        case OS_TOK_END:
+            compileEnd(getNode(control.target));
+            break;
+
+        case OS_TOK_GOTO:
+            if (control.target) {
+                emitJump(OC_JUMP, control.target);
+            } else {
+                emitOpcode(OC_COMMAND);
+                emitOperand<unsigned int>(OS_TOK_GOTO);
+                emitOperand<uint8_t>(0);
+            }
+            break;
+
+        default:
+            // Labels and Repeat don't need any code, jumping to them just continues at the next statement
+            break;
+    }
+}
+
+static enum opcode realOpcode(uint8_t token) {
+    switch (token) {
+        case OS_TOK_ADD:
+            return OC_REAL_ADD;
+        case OS_TOK_SUBTRACT:
+            return OC_REAL_SUB;
+        case OS_TOK_MULTIPLY:
+            return OC_REAL_MUL;
+        case OS_TOK_DIVIDE:
+            return OC_REAL_DIV;
+        case OS_TOK_EQUAL:
+            return OC_REAL_EQ;
+        case OS_TOK_NOT_EQUAL:
+            return OC_REAL_NE;
+        case OS_TOK_LESS_THAN:
+            return OC_REAL_LT;
+        case OS_TOK_GREATER_THAN:
+            return OC_REAL_GT;
+        case OS_TOK_LESS_THAN_EQUAL:
+            return OC_REAL_LE;
+        default:
+            return OC_REAL_GE;
+    }
+}
+
+static uint8_t compileArgs(node_t node) {
+    unsigned int argc = 0;
+
+    for (; node; node = getNode(node)->next) {
+        compileNode(getNode(node));
+        argc++;
+    }
+
+    if (argc > 255) argumentsError();
+
+    return argc;
+}
+
+static void compileNode(struct NODE *node) {
+    switch (node->data.type) {
+        case ET_NUMBER:
+            // Check once whether the literal is an integer, instead of every time it's pushed
+            emitOpcode(OC_NUMBER);
+            emitOperand<Number>(Number::exact(node->data.operand.num));
+            push();
+            break;
+
+        case ET_COMPLEX:
+            emitOpcode(OC_COMPLEX);
+            emitOperand<float>(0);
+            emitOperand<float>(node->data.operand.num);
+            push();
+            break;
+
+        case ET_STRING_LITERAL:
+            emitOpcode(OC_STRING_LITERAL);
+            emitOperand<struct var_string *>(node->data.operand.string);
+            push();
+            break;
+
+        case ET_VARIABLE:
+        case ET_STRING:
+        case ET_EQU:
+        case ET_LIST:
+        case ET_CUSTOM_LIST:
+        case ET_MATRIX: {
+            static const enum opcode loadOpcodes[] = {
+                    OC_VARIABLE, OC_STRING, OC_EQU, OC_LIST, OC_CUSTOM_LIST, OC_MATRIX
+            };
+
+            // All variable numbers share the same place in the operand union
+            emitOpcode(loadOpcodes[node->data.type - ET_VARIABLE]);
+            emitOperand<uint8_t>(node->data.operand.variableNr);
+            push();
+            break;
+        }
+
+        case ET_ANS:
+            emitOpcode(OC_ANS);
+            push();
+            break;
+
+        case ET_LIST_ELEMENT:
+        case ET_MATRIX_ELEMENT: {
+            uint8_t indices = compileArgs(node->child);
+
+            // Both variable numbers share the same place in the operand union
+            emitOpcode(node->data.type == ET_LIST_ELEMENT ? OC_LIST_ELEMENT : OC_MATRIX_ELEMENT);
+            emitOperand<uint8_t>(node->data.operand.listNr);
+            pop(indices);
+            push();
+            break;
+        }
+
+        case ET_OPERATOR: {
+            const struct op_t &op = node->data.operand.op;
+
+            if (op.token == OS_TOK_STO) {
+                struct NODE *var = getNode(getNode(node->child)->next);
+
+                compileNode(getNode(node->child));
+
+                if (var->data.type == ET_VARIABLE) {
+                    emitOpcode(OC_STORE_VARIABLE);
+                    emitOperand<uint8_t>(var->data.operand.variableNr);
+                } else if (var->data.type == ET_LIST_ELEMENT || var->data.type == ET_MATRIX_ELEMENT) {
+                    uint8_t indices = compileArgs(var->child);
+
+                    emitOpcode(var->data.type == ET_LIST_ELEMENT ? OC_STORE_LIST_ELEMENT : OC_STORE_MATRIX_ELEMENT);
+                    emitOperand<uint8_t>(var->data.operand.listNr);
+                    pop(indices);
+                } else {
+                    // Other stores are not implemented yet, a missing handler raises the error
+                    emitOpcode(OC_UNARY_OP);
+                    emitOperand<UnaryOperator *>(nullptr);
+                }
+            } else if (isUnaryOp(op.precedence)) {
+                compileNode(getNode(node->child));
+                emitOpcode(OC_UNARY_OP);
+                emitOperand<UnaryOperator *>(op.handler.unary);
+            } else {
+                compileNode(getNode(node->child));
+                compileNode(getNode(getNode(node->child)->next));
+                emitOpcode(op.real ? realOpcode(op.token) : OC_BINARY_OP);
+                emitOperand<BinaryOperator *>(op.handler.binary);
+                pop(1);
+            }
+            break;
+        }
+
+        case ET_FUSED: {
+            uint8_t leaves = compileArgs(node->child);
+
+            emitOpcode(OC_FUSED);
+            emitOperand<struct fused_expr *>(node->data.operand.fused);
+            pop(leaves - 1);
+            break;
+        }
+
+        case ET_FUNCTION_CALL: {
+            const struct func_t &func = node->data.operand.func;
+
+            if (func.handler != nullptr) {
+                compileNode(getNode(node->child));
+                emitOpcode(OC_UNARY_FUNCTION);
+                emitOperand<UnaryFunction *>(func.handler);
+                break;
+            }
+
+            uint8_t argc = compileArgs(node->child);
+
+            emitOpcode(OC_FUNCTION);
+            emitOperand<unsigned int>(func.token);
+            emitOperand<uint8_t>(argc);
+            pop(argc);
+            push();
+            break;
+        }
+
+        case ET_COMMAND: {
+            uint8_t argc = compileArgs(node->child);
+
+            emitOpcode(OC_COMMAND);
+            emitOperand<unsigned int>(node->data.operand.command);
+            emitOperand<uint8_t>(argc);
+            pop(argc);
+            break;
+        }
+
+        case ET_CONTROL:
+            compileControl(node);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * Lowers the AST to bytecode, which can be run by runProgram()
+ * @param root First node of the program, as returned by parseProgram()
+ * @return The bytecode, ending with OC_END
+ */
+uint8_t *compileProgram(node_t root) {
+    code = nullptr;
+    codeSize = codeCapacity = 0;
+    stackDepth = 0;
+    fixups = nullptr;
+    fixupCount = fixupCapacity = 0;
+
+    offsets = (unsigned int *) malloc(nodeCount * sizeof(unsigned int));
+    if (offsets == nullptr) memoryError();
+
+    for (node_t node = root; node; node = getNode(node)->next) {
+        offsets[node] = codeSize;
+        compileNode(getNode(node));
+
+        // Every expression statement leaves its result on the stack
+        if (stackDepth) {
+            emitOpcode(OC_STORE_ANS);
+            pop(1);
+        }
+    }
+
+    offsets[0] = codeSize;
+    emitOpcode(OC_END);
+
+    // The code doesn't move anymore, so all jumps can get their final address
+    for (unsigned int i = 0; i < fixupCount; i++) {
+        const uint8_t *address = code + offsets[fixups[i].target];
+
+        memcpy(code + fixups[i].position, &address, sizeof(address));
+    }
+
+    free(offsets);
+    free(fixups);
+
+    return code;
+}
@@ -0,0 +1,81 @@
+#ifndef COMPILE_H
+#define COMPILE_H
+
+#include "ast.h"
+
+#include <cstdint>
+#include <cstring>
+
+// Maximum number of values that can be on the value stack of the interpreter at once
+#define VALUE_STACK_SIZE 50
+
+/**
+ * The AST is lowered to a linear bytecode, which is a list of opcodes, each directly followed by its operands. These
+ * operands are stored unaligned, so they should always be read with the read*() functions below.
+ */
+enum opcode : uint8_t {
+    OC_END,             // End of the program
+    OC_STORE_ANS,       // Move the top value of the stack, i.e. the result of an expression statement, into Ans
+    OC_JUMP,            // const uint8_t *: continue at the given address
+    OC_JUMP_IF_FALSE,   // const uint8_t *: remove the condition from the stack, and jump if it's false
+    OC_JUMP_IF_TRUE,    // const uint8_t *: remove the condition from the stack, and jump if it's true
+    OC_FOR_ENTER,       // uint8_t, for_loop *, const uint8_t *: start a For( loop with the start, end and step from the
+                        //   stack, and jump past the loop if the body isn't run at all
+    OC_FOR_NEXT,        // for_loop *, const uint8_t *: increment the variable, and jump back if not done yet
+
+    OC_NUMBER,          // Number: push a number
+    OC_COMPLEX,         // float, float: push a complex number
+    OC_STRING_LITERAL,  // var_string *: push a copy of a string literal
+
+    OC_VARIABLE,        // uint8_t: push the value of a real/complex variable
+    OC_STRING,          // uint8_t: push the value of a string variable
+    OC_EQU,             // uint8_t: push the value of an equation
+    OC_LIST,            // uint8_t: push the value of an OS list
+    OC_CUSTOM_LIST,     // uint8_t: push the value of a custom list
+    OC_MATRIX,          // uint8_t: push the value of a matrix
+    OC_ANS,             // push the value of Ans
+    OC_LIST_ELEMENT,    // uint8_t: replace the index on top of the stack by that element of an OS list
+    OC_MATRIX_ELEMENT,  // uint8_t: replace the row and column on top of the stack by that element of a matrix
+
+    OC_STORE_VARIABLE,  // uint8_t: store the top value in a real/complex variable, and leave it on the stack
+
+    // uint8_t: store the value below the index, or the row and column, in that element of an OS list or matrix, and
+    // leave only the value on the stack
+    OC_STORE_LIST_ELEMENT,
+    OC_STORE_MATRIX_ELEMENT,
+
+    OC_UNARY_OP,        // UnaryOperator *: apply an unary operator on the top value
+    OC_BINARY_OP,       // BinaryOperator *: apply a binary operator on the two top values
+
+    // BinaryOperator *: apply an operator on two values which are inferred to be real numbers. The operator is only
+    // called if they are not, for example because a variable was complex after all.
+    OC_REAL_ADD,
+    OC_REAL_SUB,
+    OC_REAL_MUL,
+    OC_REAL_DIV,
+    OC_REAL_EQ,
+    OC_REAL_NE,
+    OC_REAL_LT,
+    OC_REAL_GT,
+    OC_REAL_LE,
+    OC_REAL_GE,
+
+    OC_FUSED,           // fused_expr *: evaluate an element-wise list expression on its leaves from the stack
+    OC_UNARY_FUNCTION,  // UnaryFunction *: call a function on the top value
+    OC_FUNCTION,        // unsigned int, uint8_t: call a function with the given amount of arguments from the stack
+    OC_COMMAND          // unsigned int, uint8_t: run a command with the given amount of arguments from the stack
+};
+
+template<typename T>
+static inline T readOperand(const uint8_t *&pc) {
+    T value;
+
+    memcpy(&value, pc, sizeof(T));
+    pc += sizeof(T);
+
+    return value;
+}
+
+uint8_t *compileProgram(node_t root);
+
+#endif
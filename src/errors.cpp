@@ -47,6 +47,10 @@ void dimensionMismatch() {
     parseError("Dimension mismatch");
 }
 
+void singularMatrixError() {
+    parseError("Singular matrix");
+}
+
 void overflowError() {
     parseError("Overflow error");
 }
@@ -58,3 +62,11 @@ void domainError() {
 void argumentsError() {
     parseError("Invalid arguments");
 }
+
+void labelError() {
+    parseError("Label not found");
+}
+
+void undefinedError() {
+    parseError("Undefined variable");
+}
@@ -17,10 +17,16 @@ void dimensionError() __attribute__((noreturn));
 
 void dimensionMismatch() __attribute__((noreturn));
 
+void singularMatrixError() __attribute__((noreturn));
+
 void overflowError() __attribute__((noreturn));
 
 void domainError() __attribute__((noreturn));
 
 void argumentsError() __attribute__((noreturn));
 
+void labelError() __attribute__((noreturn));
+
+void undefinedError() __attribute__((noreturn));
+
 #endif
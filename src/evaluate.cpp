@@ -1,101 +1,554 @@
 #include "evaluate.h"
 #include "ast.h"
 #include "commands.h"
+#include "compile.h"
+#include "errors.h"
 #include "functions.h"
 #include "operators.h"
+#include "scratch.h"
+#include "stats.h"
 #include "types.h"
 #include "variables.h"
 
+#include <cmath>
 #include <cstring>
+#include <keypadc.h>
+#include <ti/tokens.h>
 
-BaseType *evalNode(struct NODE *node) {
+static Value loadVariable(uint8_t variableNr) {
+    struct var_real *varNode = variables[variableNr];
+
+    if (varNode == nullptr) undefinedError();
+
+    if (varNode->complex) {
+        return varNode->value.cplx;
+    } else {
+        return varNode->value.num;
+    }
+}
+
+// Strings, lists and matrices are not copied, the value shares the payload with the variable
+static Value loadString(String *stringNode) {
+    return retain(stringNode);
+}
+
+static Value loadList(const struct var_list *listNode) {
+    if (listNode->complex) {
+        return retain(listNode->list.complexList);
+    } else {
+        return retain(listNode->list.list);
+    }
+}
+
+static Value loadMatrix(uint8_t matrixNr) {
+    return retain(matrices[matrixNr]);
+}
+
+Value evalNode(struct NODE *node) {
     enum etype type = node->data.type;
 
     switch (type) {
         case ET_NUMBER:
-            return new Number(node->data.operand.num->num);
+            return Number::exact(node->data.operand.num);
         case ET_COMPLEX:
-            return new Complex(node->data.operand.cplx->real, node->data.operand.cplx->imag);
-        case ET_VARIABLE: {
-            struct var_real *varNode = variables[node->data.operand.variableNr];
-
-            if (varNode->complex) {
-                return new Complex(varNode->value.cplx->real, varNode->value.cplx->imag);
-            } else {
-                return new Number(varNode->value.num->num);
-            }
+            return Complex(0, node->data.operand.num);
+        case ET_STRING_LITERAL:
+            return stringLiteral(node->data.operand.string);
+        case ET_VARIABLE:
+            return loadVariable(node->data.operand.variableNr);
+        case ET_STRING:
+            return loadString(strings[node->data.operand.stringNr]);
+        case ET_EQU:
+            return loadString(equations[node->data.operand.equationNr]);
+        case ET_LIST:
+            return loadList(lists[node->data.operand.listNr]);
+        case ET_CUSTOM_LIST:
+            return loadList(&customLists[node->data.operand.customListNr]->list);
+        case ET_MATRIX:
+            return loadMatrix(node->data.operand.matrixNr);
+        case ET_ANS:
+            return ans.share();
+        case ET_LIST_ELEMENT:
+            return listElement(node->data.operand.listNr, evalNode(getNode(node->child)));
+        case ET_MATRIX_ELEMENT: {
+            Value row = evalNode(getNode(node->child));
+            Value col = evalNode(getNode(getNode(node->child)->next));
+
+            return matrixElement(node->data.operand.matrixNr, row, col);
         }
 
-        case ET_STRING: {
-            String *stringNode = strings[node->data.operand.stringNr];
+        case ET_OPERATOR:
+            return evalOperator(node);
 
-            auto string_data = new char[stringNode->length];
-            memcpy(string_data, stringNode->string, stringNode->length);
+        case ET_FUSED: {
+            Value leaves[FUSED_MAX_LEAVES];
+            unsigned int leaf = 0;
 
-            return new String(stringNode->length, string_data);
+            for (node_t child = node->child; child; child = getNode(child)->next) {
+                leaves[leaf++] = evalNode(getNode(child));
+            }
+
+            return evalFused(node->data.operand.fused, leaves);
         }
 
-        case ET_EQU: {
-            String *equNode = equations[node->data.operand.equationNr];
+        case ET_FUNCTION_CALL:
+            return evalFunction(node);
 
-            auto string_data = new char[equNode->length];
-            memcpy(string_data, equNode->string, equNode->length);
+        case ET_COMMAND:
+            evalCommand(node);
+            break;
 
-            return new String(equNode->length, string_data);
-        }
+        default:
+            break;
+    }
 
-        case ET_LIST:
-        case ET_CUSTOM_LIST: {
-            struct var_list *listNode;
+    return Value();
+}
 
-            if (type == ET_LIST) {
-                listNode = lists[node->data.operand.listNr];
-            } else {
-                listNode = &customLists[node->data.operand.customListNr]->list;
-            }
+// Conditions should be real numbers, where everything except 0 is true
+static bool isTrue(const Value &condition) {
+    if (condition.type != TypeType::NUMBER) typeError();
 
-            if (listNode->complex) {
-                auto listData = listNode->list.complexList->elements;
+    return condition.number.isInt ? condition.number.intNum != 0 : condition.number.num != 0;
+}
 
-                return new ComplexList(listData);
-            } else {
-                auto listData = listNode->list.list->elements;
+/**
+ * Applies an operator which the type inference specialized for real numbers. If an operand isn't a real number after
+ * all, because a variable was complex, it deoptimizes to the generic operator.
+ * @param args The two operands, the result replaces the first one
+ */
+static inline void applyRealOperator(Value *args, Number (*func)(const Number &, const Number &), const uint8_t *&pc) {
+    auto op = readOperand<BinaryOperator *>(pc);
 
-                return new List(listData);
-            }
+    if (args[0].type == TypeType::NUMBER && args[1].type == TypeType::NUMBER) {
+        args[0].number = func(args[0].number, args[1].number);
+    } else {
+        STATS_COUNT(deoptimizations, 1);
+        args[0] = evalBinaryOperator(op, args[0], args[1]);
+        args[1].clear();
+    }
+}
+
+// Every loop has to jump back somewhere, so that is the place to check whether the user wants to stop
+static void checkOnKey() {
+    if (kb_On) parseError("[ON]-key pressed");
+}
+
+// The loop counts with ints if everything fits in 24 bits, including the last step past the end
+#define FOR_INT_LIMIT 0x7FFFFF
+
+static bool isSmallInt(float num) {
+    return num >= -FOR_INT_LIMIT && num <= FOR_INT_LIMIT && num == (float) (int) num;
+}
+
+static inline uint32_t floatBits(float num) {
+    uint32_t bits;
+
+    memcpy(&bits, &num, sizeof(bits));
+
+    return bits;
+}
+
+static bool inForRange(float value, const struct for_loop &loop) {
+    return loop.step < 0 ? value >= loop.end : value <= loop.end;
+}
+
+/**
+ * Enters a For( loop: the end and step are evaluated only once, and the start is stored in the loop variable
+ * @return Whether the body should be run at least once
+ */
+static bool enterForLoop(uint8_t variableNr, struct for_loop &loop, const Value &start, const Value &end,
+                         const Value &step) {
+    if (start.type != TypeType::NUMBER || end.type != TypeType::NUMBER || step.type != TypeType::NUMBER) typeError();
+
+    float startNum = start.number.num;
+
+    storeVariable(variableNr, start);
+    loop.var = variables[variableNr];
+    loop.end = end.number.num;
+    loop.step = step.number.num;
+    loop.integer = isSmallInt(startNum) && isSmallInt(loop.end) && isSmallInt(loop.step) &&
+                   isSmallInt(fabsf(loop.end) + fabsf(loop.step));
+
+    if (loop.integer) {
+        loop.intCounter = (int) startNum;
+        loop.intEnd = (int) loop.end;
+        loop.intStep = (int) loop.step;
+        loop.counterBits = floatBits(startNum);
+    }
+
+    return inForRange(startNum, loop);
+}
+
+/**
+ * Increments the variable of a For( loop at its End. Just like the OS, the variable is always incremented, so it's one
+ * step past the end after the loop.
+ * @return Whether the body should be run again
+ */
+static bool nextForLoop(struct for_loop &loop) {
+    struct var_real *var = loop.var;
+
+    if (var == nullptr) return false;
+    if (var->complex) typeError();
+
+    Number &counter = var->value.num;
+
+    if (loop.integer) {
+        if (floatBits(counter.num) == loop.counterBits) {
+            loop.intCounter += loop.intStep;
+            counter = Number::fromInt(loop.intCounter);
+            loop.counterBits = floatBits(counter.num);
+
+            return loop.intStep < 0 ? loop.intCounter >= loop.intEnd : loop.intCounter <= loop.intEnd;
         }
 
-        case ET_MATRIX: {
-            Matrix *matrix = matrices[node->data.operand.matrixNr];
-            auto matrixData = matrix->elements;
+        // The body has changed the variable, which might not be an integer anymore
+        loop.integer = false;
+    }
+
+    counter = Number(counter.num + loop.step);
+
+    return inForRange(counter.num, loop);
+}
+
+/**
+ * Runs the End of a block, which loops back or just continues with the next statement
+ * @param node Index of the End
+ * @param opener Index of the statement that started the block
+ * @return The statement to continue at
+ */
+static node_t evalEnd(node_t node, node_t opener) {
+    struct NODE *block = getNode(opener);
+
+    switch (block->data.operand.control.token) {
+        case OS_TOK_WHILE:
+            checkOnKey();
+
+            return opener;
+
+        case OS_TOK_REPEAT:
+            checkOnKey();
+
+            return isTrue(evalNode(getNode(block->child))) ? getNode(node)->next : block->next;
+
+        case OS_TOK_FOR:
+            checkOnKey();
+
+            return nextForLoop(forLoops[block->data.operand.control.loop]) ? block->next : getNode(node)->next;
+
+        default:
+            return getNode(node)->next;
+    }
+}
+
+/**
+ * Runs a control statement
+ * @param node Index of the statement
+ * @return The statement to continue at
+ */
+static node_t evalControl(node_t node) {
+    struct NODE *tmp = getNode(node);
+    const struct control_t &control = tmp->data.operand.control;
+
+    switch (control.token) {
+        case OS_TOK_IF:
+        case OS_TOK_WHILE:
+            if (isTrue(evalNode(getNode(tmp->child)))) return tmp->next;
+
+            return getNode(control.target)->next;
+
+        case OS_TOK_ELSE:
+            return getNode(control.target)->next;
+
+        case OS_TOK_FOR: {
+            node_t start = getNode(tmp->child)->next;
+            node_t end = getNode(start)->next;
+            node_t step = getNode(end)->next;
 
-            return new Matrix(matrixData);
+            Value startValue = evalNode(getNode(start));
+            Value endValue = evalNode(getNode(end));
+            Value stepValue = step ? evalNode(getNode(step)) : Number::fromInt(1);
+
+            if (enterForLoop(getNode(tmp->child)->data.operand.variableNr, forLoops[control.loop], startValue,
+                             endValue, stepValue)) {
+                return tmp->next;
+            }
+
+            return getNode(control.target)->next;
         }
 
-        case ET_OPERATOR:
-            return evalOperator(node);
+        case OS_TOK_END:
+            return evalEnd(node, control.target);
 
-        case ET_FUNCTION_CALL:
-            return evalFunction(node);
+        case OS_TOK_GOTO:
+            if (!control.target) labelError();
+            checkOnKey();
 
-        case ET_COMMAND:
-            evalCommand(node);
-            break;
+            return control.target;
 
         default:
-            break;
+            return tmp->next;
     }
+}
+
+void evalNodes(node_t node) {
+    scratchInit();
+
+    while (node) {
+        // The temporaries of the previous statement should all be gone
+        scratchReset();
+
+        if (getNode(node)->data.type == ET_CONTROL) {
+            node = evalControl(node);
+            continue;
+        }
+
+        Value result = evalNode(getNode(node));
+
+        // Commands don't have a result, so they leave Ans alone
+        if (result.type != TypeType::NONE) storeAns(result);
 
-    return nullptr;
+        node = getNode(node)->next;
+    }
 }
 
-void evalNodes(struct NODE *node) {
-    while (node != nullptr) {
-        BaseType *result = evalNode(node);
+/**
+ * Runs the bytecode from compileProgram(). This is the same as evalNodes(), but without walking the tree: the
+ * operands of each operator are just the values on top of the stack.
+ * @param code Bytecode to run
+ */
+void runProgram(const uint8_t *code) {
+    static Value stack[VALUE_STACK_SIZE];
+    unsigned int sp = 0;
+    const uint8_t *pc = code;
+
+    scratchInit();
+
+    for (;;) {
+        switch (*pc++) {
+            case OC_END:
+                return;
+
+            case OC_JUMP:
+                checkOnKey();
+                pc = readOperand<const uint8_t *>(pc);
+                break;
+
+            case OC_JUMP_IF_FALSE: {
+                auto target = readOperand<const uint8_t *>(pc);
+                bool condition = isTrue(stack[sp - 1]);
+
+                stack[--sp].clear();
+                if (!condition) pc = target;
+                break;
+            }
+
+            case OC_JUMP_IF_TRUE: {
+                auto target = readOperand<const uint8_t *>(pc);
+                bool condition = isTrue(stack[sp - 1]);
+
+                stack[--sp].clear();
+                if (condition) {
+                    checkOnKey();
+                    pc = target;
+                }
+                break;
+            }
+
+            case OC_FOR_ENTER: {
+                auto variableNr = readOperand<uint8_t>(pc);
+                auto loop = readOperand<struct for_loop *>(pc);
+                auto target = readOperand<const uint8_t *>(pc);
+                Value *args = &stack[sp - 3];
+                bool enter = enterForLoop(variableNr, *loop, args[0], args[1], args[2]);
+
+                for (uint8_t i = 0; i < 3; i++) {
+                    args[i].clear();
+                }
+
+                sp -= 3;
+                if (!enter) pc = target;
+                break;
+            }
+
+            case OC_FOR_NEXT: {
+                auto loop = readOperand<struct for_loop *>(pc);
+                auto target = readOperand<const uint8_t *>(pc);
+
+                if (nextForLoop(*loop)) {
+                    checkOnKey();
+                    pc = target;
+                }
+                break;
+            }
+
+            case OC_STORE_VARIABLE:
+                storeVariable(readOperand<uint8_t>(pc), stack[sp - 1]);
+                break;
+
+            case OC_STORE_LIST_ELEMENT:
+                storeListElement(readOperand<uint8_t>(pc), stack[sp - 1], stack[sp - 2]);
+                stack[--sp].clear();
+                break;
+
+            case OC_STORE_MATRIX_ELEMENT:
+                storeMatrixElement(readOperand<uint8_t>(pc), stack[sp - 2], stack[sp - 1], stack[sp - 3]);
+                stack[--sp].clear();
+                stack[--sp].clear();
+                break;
+
+            case OC_STORE_ANS:
+                // This ends every expression statement, so none of its temporaries should be left
+                storeAns(stack[--sp]);
+                scratchReset();
+                break;
 
-        // todo: store to Ans
-        delete result;
+            case OC_NUMBER:
+                stack[sp++] = readOperand<Number>(pc);
+                break;
 
-        node = node->next;
+            case OC_COMPLEX: {
+                float real = readOperand<float>(pc);
+                float imag = readOperand<float>(pc);
+
+                stack[sp++] = Complex(real, imag);
+                break;
+            }
+
+            case OC_STRING_LITERAL:
+                stack[sp++] = stringLiteral(readOperand<struct var_string *>(pc));
+                break;
+
+            case OC_VARIABLE:
+                stack[sp++] = loadVariable(readOperand<uint8_t>(pc));
+                break;
+
+            case OC_STRING:
+                stack[sp++] = loadString(strings[readOperand<uint8_t>(pc)]);
+                break;
+
+            case OC_EQU:
+                stack[sp++] = loadString(equations[readOperand<uint8_t>(pc)]);
+                break;
+
+            case OC_LIST:
+                stack[sp++] = loadList(lists[readOperand<uint8_t>(pc)]);
+                break;
+
+            case OC_CUSTOM_LIST:
+                stack[sp++] = loadList(&customLists[readOperand<uint8_t>(pc)]->list);
+                break;
+
+            case OC_MATRIX:
+                stack[sp++] = loadMatrix(readOperand<uint8_t>(pc));
+                break;
+
+            case OC_ANS:
+                stack[sp++] = ans.share();
+                break;
+
+            case OC_LIST_ELEMENT:
+                stack[sp - 1] = listElement(readOperand<uint8_t>(pc), stack[sp - 1]);
+                break;
+
+            case OC_MATRIX_ELEMENT:
+                stack[sp - 2] = matrixElement(readOperand<uint8_t>(pc), stack[sp - 2], stack[sp - 1]);
+                stack[--sp].clear();
+                break;
+
+            case OC_UNARY_OP:
+                stack[sp - 1] = evalUnaryOperator(readOperand<UnaryOperator *>(pc), stack[sp - 1]);
+                break;
+
+            case OC_BINARY_OP:
+                stack[sp - 2] = evalBinaryOperator(readOperand<BinaryOperator *>(pc), stack[sp - 2], stack[sp - 1]);
+                stack[--sp].clear();
+                break;
+
+            case OC_REAL_ADD:
+                applyRealOperator(&stack[--sp - 1], realAdd, pc);
+                break;
+
+            case OC_REAL_SUB:
+                applyRealOperator(&stack[--sp - 1], realSub, pc);
+                break;
+
+            case OC_REAL_MUL:
+                applyRealOperator(&stack[--sp - 1], realMul, pc);
+                break;
+
+            case OC_REAL_DIV:
+                applyRealOperator(&stack[--sp - 1], realDiv, pc);
+                break;
+
+            case OC_REAL_EQ:
+                applyRealOperator(&stack[--sp - 1], realEQ, pc);
+                break;
+
+            case OC_REAL_NE:
+                applyRealOperator(&stack[--sp - 1], realNE, pc);
+                break;
+
+            case OC_REAL_LT:
+                applyRealOperator(&stack[--sp - 1], realLT, pc);
+                break;
+
+            case OC_REAL_GT:
+                applyRealOperator(&stack[--sp - 1], realGT, pc);
+                break;
+
+            case OC_REAL_LE:
+                applyRealOperator(&stack[--sp - 1], realLE, pc);
+                break;
+
+            case OC_REAL_GE:
+                applyRealOperator(&stack[--sp - 1], realGE, pc);
+                break;
+
+            case OC_FUSED: {
+                auto fused = readOperand<struct fused_expr *>(pc);
+
+                sp -= fused->leaves - 1;
+                stack[sp - 1] = evalFused(fused, &stack[sp - 1]);
+                break;
+            }
+
+            case OC_UNARY_FUNCTION:
+                stack[sp - 1] = stack[sp - 1].eval(*readOperand<UnaryFunction *>(pc));
+                break;
+
+            case OC_FUNCTION: {
+                unsigned int func = readOperand<unsigned int>(pc);
+                uint8_t argc = readOperand<uint8_t>(pc);
+                Value *args = &stack[sp - argc];
+                Value result = callFunction(func, args, argc);
+
+                for (uint8_t i = 0; i < argc; i++) {
+                    args[i].clear();
+                }
+
+                sp -= argc;
+                stack[sp++] = static_cast<Value &&>(result);
+                break;
+            }
+
+            case OC_COMMAND: {
+                unsigned int command = readOperand<unsigned int>(pc);
+                uint8_t argc = readOperand<uint8_t>(pc);
+                Value *args = &stack[sp - argc];
+
+                runCommand(command, args, argc);
+
+                for (uint8_t i = 0; i < argc; i++) {
+                    args[i].clear();
+                }
+
+                sp -= argc;
+                break;
+            }
+
+            default:
+                break;
+        }
     }
 }
@@ -1,10 +1,13 @@
 #ifndef EVALUATE_H
 #define EVALUATE_H
 
+#include "ast.h"
 #include "types.h"
 
-BaseType *evalNode(struct NODE *node);
+Value evalNode(struct NODE *node);
 
-void evalNodes(struct NODE *node);
+void evalNodes(node_t node);
+
+void runProgram(const uint8_t *code);
 
 #endif
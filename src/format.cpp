@@ -0,0 +1,376 @@
+#include "format.h"
+#include "errors.h"
+#include "globals.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// The OS never displays more digits than this
+#define MAX_DIGITS 10
+
+/**
+ * A float only has about 7 significant digits, but its shortest digits can be up to 9 long, like 1.9999999 for a float
+ * which is 1 ulp below 2. The OS shows 10 of its 14 digits so rounding errors don't show, and in the same way fractions
+ * are rounded to this many digits in Float mode, which shows 2 instead. Integers are exact, so they keep all their
+ * digits, and Fix mode rounds from the full digits, so it isn't rounded twice.
+ */
+#define FLOAT_DIGITS 7
+
+// Numbers below this many powers of 10 get an exponent in Normal mode, just like from 10^MAX_DIGITS on
+#define MIN_NORMAL_EXPONENT (-3)
+
+/**
+ * The shortest digits are found with Ryu (Ulf Adams, "Ryu: fast float-to-string conversion", 2018), which only needs
+ * integer arithmetic. These are 2^k / 5^i and 5^i / 2^k, scaled to POW5_INV_BITCOUNT and POW5_BITCOUNT bits.
+ */
+#define POW5_INV_BITCOUNT 59
+#define POW5_BITCOUNT 61
+
+static const uint64_t POW5_INV_SPLIT[31] = {
+    576460752303423489u, 461168601842738791u, 368934881474191033u, 295147905179352826u, 472236648286964522u,
+    377789318629571618u, 302231454903657294u, 483570327845851670u, 386856262276681336u, 309485009821345069u,
+    495176015714152110u, 396140812571321688u, 316912650057057351u, 507060240091291761u, 405648192073033409u,
+    324518553658426727u, 519229685853482763u, 415383748682786211u, 332306998946228969u, 531691198313966350u,
+    425352958651173080u, 340282366920938464u, 544451787073501542u, 435561429658801234u, 348449143727040987u,
+    557518629963265579u, 446014903970612463u, 356811923176489971u, 570899077082383953u, 456719261665907162u,
+    365375409332725730u
+};
+
+static const uint64_t POW5_SPLIT[48] = {
+    1152921504606846976u, 1441151880758558720u, 1801439850948198400u, 2251799813685248000u, 1407374883553280000u,
+    1759218604441600000u, 2199023255552000000u, 1374389534720000000u, 1717986918400000000u, 2147483648000000000u,
+    1342177280000000000u, 1677721600000000000u, 2097152000000000000u, 1310720000000000000u, 1638400000000000000u,
+    2048000000000000000u, 1280000000000000000u, 1600000000000000000u, 2000000000000000000u, 1250000000000000000u,
+    1562500000000000000u, 1953125000000000000u, 1220703125000000000u, 1525878906250000000u, 1907348632812500000u,
+    1192092895507812500u, 1490116119384765625u, 1862645149230957031u, 1164153218269348144u, 1455191522836685180u,
+    1818989403545856475u, 2273736754432320594u, 1421085471520200371u, 1776356839400250464u, 2220446049250313080u,
+    1387778780781445675u, 1734723475976807094u, 2168404344971008868u, 1355252715606880542u, 1694065894508600678u,
+    2117582368135750847u, 1323488980084844279u, 1654361225106055349u, 2067951531382569187u, 1292469707114105741u,
+    1615587133892632177u, 2019483917365790221u, 1262177448353618888u
+};
+
+// The number of bits of 5^e
+static int32_t pow5bits(int32_t e) {
+    return ((e * 1217359) >> 19) + 1;
+}
+
+// floor(log10(2^e))
+static int32_t log10Pow2(int32_t e) {
+    return (e * 78913) >> 18;
+}
+
+// floor(log10(5^e))
+static int32_t log10Pow5(int32_t e) {
+    return (e * 732923) >> 20;
+}
+
+static uint8_t pow5Factor(uint32_t value) {
+    uint8_t count = 0;
+
+    while (value % 5 == 0) {
+        value /= 5;
+        count++;
+    }
+
+    return count;
+}
+
+// (m * factor) >> shift, where shift is more than 32, without needing the full 96-bit product
+static uint32_t mulShift(uint32_t m, uint64_t factor, int32_t shift) {
+    uint64_t low = (uint64_t) m * (uint32_t) factor;
+    uint64_t high = (uint64_t) m * (uint32_t) (factor >> 32);
+
+    return (uint32_t) (((low >> 32) + high) >> (shift - 32));
+}
+
+/**
+ * Returns the fewest decimal digits which still read back as num, which must be positive and finite: num is the
+ * result times 10^exponent. There are at most 9 of them, which always fit in the 10 digits of the OS.
+ */
+static uint32_t shortestDigits(float num, int32_t &exponent) {
+    uint32_t bits;
+    memcpy(&bits, &num, sizeof(bits));
+
+    uint32_t ieeeMantissa = bits & 0x7FFFFF;
+    uint32_t ieeeExponent = bits >> 23;
+    int32_t e2;
+    uint32_t m2;
+
+    // The number is m2 * 2^e2, with 2 more bits to hold the halfway points to its neighbours
+    if (ieeeExponent == 0) {
+        e2 = 1 - 127 - 23 - 2;
+        m2 = ieeeMantissa;
+    } else {
+        e2 = (int32_t) ieeeExponent - 127 - 23 - 2;
+        m2 = ((uint32_t) 1 << 23) | ieeeMantissa;
+    }
+
+    // Every number between mm and mp reads back as num, and so do the bounds themselves if m2 is even
+    bool acceptBounds = (m2 & 1) == 0;
+    uint32_t mv = 4 * m2;
+    uint32_t mp = 4 * m2 + 2;
+    uint32_t mm = 4 * m2 - 1 - (ieeeMantissa != 0 || ieeeExponent <= 1);
+
+    // Scale all three to decimal, and remember whether anything but zeroes was cut off in the process
+    uint32_t vr, vp, vm;
+    int32_t e10;
+    bool vmIsTrailingZeros = false;
+    bool vrIsTrailingZeros = false;
+    uint8_t lastRemovedDigit = 0;
+
+    if (e2 >= 0) {
+        int32_t q = log10Pow2(e2);
+        int32_t shift = -e2 + q + POW5_INV_BITCOUNT + pow5bits(q) - 1;
+
+        e10 = q;
+        vr = mulShift(mv, POW5_INV_SPLIT[q], shift);
+        vp = mulShift(mp, POW5_INV_SPLIT[q], shift);
+        vm = mulShift(mm, POW5_INV_SPLIT[q], shift);
+
+        if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+            // The digit below vr is needed for rounding, even if the loop below won't remove anything
+            int32_t lastShift = -e2 + q - 1 + POW5_INV_BITCOUNT + pow5bits(q - 1) - 1;
+
+            lastRemovedDigit = mulShift(mv, POW5_INV_SPLIT[q - 1], lastShift) % 10;
+        }
+
+        if (q <= 9) {
+            // Only one of them can be a multiple of 5
+            if (mv % 5 == 0) {
+                vrIsTrailingZeros = pow5Factor(mv) >= q;
+            } else if (acceptBounds) {
+                vmIsTrailingZeros = pow5Factor(mm) >= q;
+            } else {
+                vp -= pow5Factor(mp) >= q;
+            }
+        }
+    } else {
+        int32_t q = log10Pow5(-e2);
+        int32_t i = -e2 - q;
+        int32_t shift = q - (pow5bits(i) - POW5_BITCOUNT);
+
+        e10 = q + e2;
+        vr = mulShift(mv, POW5_SPLIT[i], shift);
+        vp = mulShift(mp, POW5_SPLIT[i], shift);
+        vm = mulShift(mm, POW5_SPLIT[i], shift);
+
+        if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+            int32_t lastShift = q - 1 - (pow5bits(i + 1) - POW5_BITCOUNT);
+
+            lastRemovedDigit = mulShift(mv, POW5_SPLIT[i + 1], lastShift) % 10;
+        }
+
+        if (q <= 1) {
+            // mv has at least 2 trailing zero bits, so dividing it by 2^q is exact
+            vrIsTrailingZeros = true;
+
+            if (acceptBounds) {
+                vmIsTrailingZeros = ieeeMantissa != 0 || ieeeExponent <= 1;
+            } else {
+                vp--;
+            }
+        } else if (q < 31) {
+            vrIsTrailingZeros = (mv & (((uint32_t) 1 << (q - 1)) - 1)) == 0;
+        }
+    }
+
+    // Remove digits as long as the bounds still differ, which leaves the shortest digits between them
+    int32_t removed = 0;
+    uint32_t output;
+
+    if (vmIsTrailingZeros || vrIsTrailingZeros) {
+        while (vp / 10 > vm / 10) {
+            vmIsTrailingZeros &= vm % 10 == 0;
+            vrIsTrailingZeros &= lastRemovedDigit == 0;
+            lastRemovedDigit = vr % 10;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+
+        if (vmIsTrailingZeros) {
+            while (vm % 10 == 0) {
+                vrIsTrailingZeros &= lastRemovedDigit == 0;
+                lastRemovedDigit = vr % 10;
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+
+        // Exactly halfway rounds to even
+        if (vrIsTrailingZeros && lastRemovedDigit == 5 && vr % 2 == 0) lastRemovedDigit = 4;
+
+        output = vr + ((vr == vm && (!acceptBounds || !vmIsTrailingZeros)) || lastRemovedDigit >= 5);
+    } else {
+        while (vp / 10 > vm / 10) {
+            lastRemovedDigit = vr % 10;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+
+        output = vr + (vr == vm || lastRemovedDigit >= 5);
+    }
+
+    exponent = e10 + removed;
+    return output;
+}
+
+// Rounds the exponent down to a multiple of 3
+static int engExponent(int exponent) {
+    if (exponent >= 0) return exponent / 3 * 3;
+
+    return -((2 - exponent) / 3 * 3);
+}
+
+/**
+ * Keeps the first keep digits and rounds half up. Returns true if that carried into a new first digit, like 9.99 to
+ * 10.0, in which case the digits are now a single 1.
+ */
+static bool roundDigits(char *digits, uint8_t &length, int keep) {
+    if (keep < 0) {
+        length = 0;
+        return false;
+    }
+
+    bool up = digits[keep] >= '5';
+
+    length = keep;
+    if (!up) return false;
+
+    for (int i = length - 1; i >= 0; i--) {
+        if (digits[i] != '9') {
+            digits[i]++;
+            return false;
+        }
+
+        digits[i] = '0';
+    }
+
+    digits[0] = '1';
+    length = 1;
+
+    return true;
+}
+
+char *formatNumInto(char *buf, float num) {
+    // We could have used a very simple routine and let the OS handle it. Something like this would work:
+    //
+    //  real_t tmp_real = os_FloatToReal(num);
+    //  os_RealToStr(buf, &tmp_real, ...)
+    //
+    // However, testing turns out that there are huge rounding errors, so let's still use our custom routine.
+    if (!std::isfinite(num)) overflowError();
+
+    bool negative = num < 0;
+    char digitBuf[MAX_DIGITS];
+    char *digits = digitBuf + MAX_DIGITS;
+    int sciExponent;
+
+    bool fraction = false;
+
+    if (num == 0) {
+        *--digits = '0';
+        sciExponent = 0;
+    } else {
+        int32_t exponent;
+        uint32_t value = shortestDigits(fabsf(num), exponent);
+
+        fraction = exponent < 0;
+
+        do {
+            *--digits = (char) ('0' + value % 10);
+            value /= 10;
+        } while (value);
+
+        sciExponent = exponent + (digitBuf + MAX_DIGITS - digits) - 1;
+    }
+
+    uint8_t length = digitBuf + MAX_DIGITS - digits;
+
+    if (globals.fixNr == 255 && fraction && length > FLOAT_DIGITS) {
+        if (roundDigits(digits, length, FLOAT_DIGITS)) sciExponent++;
+
+        while (digits[length - 1] == '0') length--;
+    }
+
+    bool scientific;
+    int exponent;
+    int intDigits;
+    int decimals;
+
+    while (true) {
+        scientific = globals.normalSciEngMode != NORMAL_MODE || sciExponent >= MAX_DIGITS ||
+                     sciExponent < MIN_NORMAL_EXPONENT;
+        exponent = 0;
+
+        if (scientific) {
+            exponent = globals.normalSciEngMode == ENG_MODE ? engExponent(sciExponent) : sciExponent;
+        }
+
+        // The digits before the decimal point. If there are none, the digits start after -intDigits zeroes.
+        intDigits = sciExponent - exponent + 1;
+
+        if (globals.fixNr == 255) {
+            decimals = length > intDigits ? length - intDigits : 0;
+            break;
+        }
+
+        // Fix mode shows as many decimals as fit in the digits of the OS
+        decimals = globals.fixNr;
+        if (intDigits > 0 && decimals > MAX_DIGITS - intDigits) decimals = MAX_DIGITS - intDigits;
+
+        if (intDigits + decimals >= length || !roundDigits(digits, length, intDigits + decimals)) break;
+
+        // The carry can move the decimal point, or even the exponent, so place it again
+        sciExponent++;
+    }
+
+    char *out = buf;
+
+    // Numbers which round to 0 don't get a sign
+    if (negative && length) *out++ = 0x1A;
+
+    if (intDigits <= 0) *out++ = '0';
+
+    for (int i = 0; i < intDigits; i++) {
+        *out++ = i < length ? digits[i] : '0';
+    }
+
+    if (decimals) {
+        *out++ = '.';
+
+        for (int i = intDigits; i < intDigits + decimals; i++) {
+            *out++ = i >= 0 && i < length ? digits[i] : '0';
+        }
+    }
+
+    if (scientific) {
+        *out++ = 0x1B;
+
+        if (exponent < 0) {
+            *out++ = 0x1A;
+            exponent = -exponent;
+        }
+
+        if (exponent >= 10) *out++ = (char) ('0' + exponent / 10);
+        *out++ = (char) ('0' + exponent % 10);
+    }
+
+    *out = '\0';
+
+    return out;
+}
+
+char *formatNum(float num) {
+    static char buf[FORMAT_NUM_SIZE];
+
+    formatNumInto(buf, num);
+
+    return buf;
+}
@@ -0,0 +1,18 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+// The longest formatted number, like "-1.000000000E-38" in Sci and Fix 9 mode, including the terminating 0
+#define FORMAT_NUM_SIZE 20
+
+/**
+ * Formats a number the way the OS displays it, with the shortest digits that read back as the same float, rounded to
+ * the precision of a float, and the Normal/Sci/Eng and Fix modes. Negative signs and exponents use the OS glyphs 0x1A
+ * and 0x1B. The number is written to buf, which needs room for FORMAT_NUM_SIZE characters, and the end of the string
+ * is returned.
+ */
+char *formatNumInto(char *buf, float num);
+
+// Formats a number into a static buffer, which is overwritten by the next call
+char *formatNum(float num);
+
+#endif
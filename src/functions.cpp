@@ -1,132 +1,198 @@
 #include "functions.h"
 #include "ast.h"
 #include "evaluate.h"
+#include "linalg.h"
 #include "main.h"
+#include "trig.h"
 #include "types.h"
 #include "utils.h"
+#include "variables.h"
 
+#include <cstring>
 #include <ti/tokens.h>
 
-BaseType *unaryFunction(NODE *firstChild, unsigned int childNo, UnaryFunction *function) {
-    if (childNo != 1) argumentsError();
+// The functions don't have any state, so a single instance of each is enough
+static FuncRound funcRound;
+static FuncDet funcDet;
+static FuncRef funcRef;
+static FuncRref funcRref;
+static FuncSin funcSin;
+static FuncCos funcCos;
+static FuncTan funcTan;
+
+UnaryFunction *getUnaryFunction(unsigned int func) {
+    switch (func) {
+        case OS_TOK_ROUND:
+            return &funcRound;
+        case OS_TOK_DET:
+            return &funcDet;
+        case FUNC_REF:
+            return &funcRef;
+        case FUNC_RREF:
+            return &funcRref;
+        case OS_TOK_SIN:
+            return &funcSin;
+        case OS_TOK_COS:
+            return &funcCos;
+        case OS_TOK_TAN:
+            return &funcTan;
+        default:
+            return nullptr;
+    }
+}
 
-    auto arg = evalNode(firstChild);
-    BaseType *result = arg->eval(*function);
+Value callFunction(unsigned int func, Value *args, unsigned int argc) {
+    if (argc == 1) {
+        UnaryFunction *funcHandle = getUnaryFunction(func);
+        if (funcHandle == nullptr) argumentsError();
 
-    delete arg;
+        return args[0].eval(*funcHandle);
+    }
 
-    return result;
+    return Value();
 }
 
-BaseType *evalFunction(struct NODE *funcNode) {
+Value stringLiteral(const struct var_string *string) {
+    auto stringData = String::allocate(string->length);
+    memcpy(stringData, string->data, string->length);
+
+    return new String(string->length, stringData);
+}
+
+Value evalFunction(struct NODE *funcNode) {
+    Value args[MAX_ARGS];
     unsigned int childNo = 0;
-    BaseType *result = nullptr;
+    const struct func_t &func = funcNode->data.operand.func;
 
-    struct NODE *tmp = funcNode->child;
-    while (tmp != nullptr) {
-        childNo++;
-        tmp = tmp->next;
+    // Functions with a single argument are already resolved by the parser
+    if (func.handler != nullptr) {
+        Value arg = evalNode(getNode(funcNode->child));
+
+        return arg.eval(*func.handler);
     }
 
-    unsigned int func = funcNode->data.operand.func;
-
-    if (childNo == 1) {
-        UnaryFunction *funcHandle;
-        switch (func) {
-            case OS_TOK_ROUND:
-                funcHandle = new FuncRound();
-                break;
-            case OS_TOK_SIN:
-                funcHandle = new FuncSin();
-                break;
-            case OS_TOK_COS:
-                funcHandle = new FuncCos();
-                break;
-            case OS_TOK_TAN:
-                funcHandle = new FuncTan();
-                break;
-            default:
-                argumentsError();
-        }
-
-        result = unaryFunction(funcNode->child, childNo, funcHandle);
+    for (node_t tmp = funcNode->child; tmp; tmp = getNode(tmp)->next) {
+        if (childNo == MAX_ARGS) argumentsError();
+
+        args[childNo++] = evalNode(getNode(tmp));
     }
 
-    return result;
+    return callFunction(func.token, args, childNo);
 }
 
-BaseType *UnaryFunction::eval(__attribute__((unused)) Number &rhs) {
+Value UnaryFunction::eval(__attribute__((unused)) Number &rhs) {
     typeError();
 }
 
-BaseType *UnaryFunction::eval(__attribute__((unused)) Complex &rhs) {
+Value UnaryFunction::eval(__attribute__((unused)) Complex &rhs) {
     typeError();
 }
 
-BaseType *UnaryFunction::eval(List &rhs) {
-    if (rhs.elements.empty()) dimensionError();
+Value UnaryFunction::eval(List &rhs) {
+    if (!rhs.length) dimensionError();
+
+    List *result = List::createResult(rhs);
 
-    auto newElements = rhs.elements;
+    for (unsigned int i = 0; i < rhs.length; i++) {
+        Number element(rhs.elements[i]);
 
-    for (auto &number : newElements) {
-        number = dynamic_cast<Number &>(*this->eval(number));
+        result->elements[i] = this->eval(element).asNumber().num;
     }
 
-    return new List(newElements);
+    return result;
 }
 
-BaseType *UnaryFunction::eval(ComplexList &rhs) {
-    if (rhs.elements.empty()) dimensionError();
+Value UnaryFunction::eval(ComplexList &rhs) {
+    if (!rhs.length) dimensionError();
 
-    auto newElements = rhs.elements;
+    ComplexList *result = ComplexList::createResult(rhs);
 
-    for (auto &cplx : newElements) {
-        cplx = dynamic_cast<Complex &>(*this->eval(cplx));
+    for (unsigned int i = 0; i < rhs.length; i++) {
+        Complex element = rhs.at(i);
+
+        result->set(i, this->eval(element).asComplex());
     }
 
-    return new ComplexList(newElements);
+    return result;
 }
 
-BaseType *UnaryFunction::eval(__attribute__((unused)) String &rhs) {
+Value UnaryFunction::eval(__attribute__((unused)) String &rhs) {
     typeError();
 }
 
-BaseType *UnaryFunction::eval(__attribute__((unused)) Matrix &rhs) {
+Value UnaryFunction::eval(__attribute__((unused)) Matrix &rhs) {
     typeError();
 }
 
-BaseType *FuncSin::eval(Number &rhs) {
-    return new Number(sinfMode(rhs.num));
+Value FuncSin::eval(Number &rhs) {
+    return Number(sinfMode(rhs.num));
+}
+
+Value FuncSin::eval(List &rhs) {
+    if (!rhs.length) dimensionError();
+
+    List *result = List::createResult(rhs);
+    sinfModeList(result->elements, rhs.elements, rhs.length);
+
+    return result;
+}
+
+Value FuncCos::eval(Number &rhs) {
+    return Number(cosfMode(rhs.num));
 }
 
-BaseType *FuncCos::eval(Number &rhs) {
-    return new Number(cosfMode(rhs.num));
+Value FuncCos::eval(List &rhs) {
+    if (!rhs.length) dimensionError();
+
+    List *result = List::createResult(rhs);
+    cosfModeList(result->elements, rhs.elements, rhs.length);
+
+    return result;
+}
+
+Value FuncTan::eval(Number &rhs) {
+    return Number(tanfMode(rhs.num));
 }
 
-BaseType *FuncTan::eval(Number &rhs) {
-    return new Number(tanfMode(rhs.num));
+Value FuncTan::eval(List &rhs) {
+    if (!rhs.length) dimensionError();
+
+    List *result = List::createResult(rhs);
+    tanfModeList(result->elements, rhs.elements, rhs.length);
+
+    return result;
 }
 
-BaseType *FuncRound::eval(Number &rhs) {
+Value FuncRound::eval(Number &rhs) {
     // todo: use a custom routine, as this one sucks!
-    // return new Number(roundf_custom(rhs.num * 1e9) / 1e9);
-    return new Number(roundf_custom(rhs.num));
+    // return Number(roundf_custom(rhs.num * 1e9) / 1e9);
+    return Number(roundf_custom(rhs.num));
 }
 
-BaseType *FuncRound::eval(Complex &rhs) {
-    return new Complex(roundf_custom(rhs.real * 1e9) / 1e9, roundf_custom(rhs.imag * 1e9) / 1e9);
+Value FuncRound::eval(Complex &rhs) {
+    return Complex(roundf_custom(rhs.real * 1e9) / 1e9, roundf_custom(rhs.imag * 1e9) / 1e9);
 }
 
-BaseType *FuncRound::eval(Matrix &rhs) {
-    if (rhs.elements.empty()) dimensionError();
+Value FuncRound::eval(Matrix &rhs) {
+    if (!rhs.size()) dimensionError();
 
-    auto newElements = rhs.elements;
+    Matrix *result = Matrix::createResult(rhs);
 
-    for (auto &row : newElements) {
-        for (auto &col : row) {
-            col = dynamic_cast<Number &>(*this->eval(col));
-        }
+    for (unsigned int i = 0; i < rhs.size(); i++) {
+        result->elements[i] = roundf_custom(rhs.elements[i]);
     }
 
-    return new Matrix(newElements);
+    return result;
+}
+
+Value FuncDet::eval(Matrix &rhs) {
+    return Number(determinant(rhs));
+}
+
+Value FuncRef::eval(Matrix &rhs) {
+    return rowEchelon(rhs, false);
+}
+
+Value FuncRref::eval(Matrix &rhs) {
+    return rowEchelon(rhs, true);
 }
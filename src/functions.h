@@ -4,43 +4,77 @@
 #include "ast.h"
 #include "types.h"
 
+#include <ti/tokens.h>
+
 class UnaryFunction {
 public:
     virtual ~UnaryFunction() = default;
 
-    virtual BaseType *eval(Number &rhs);
+    virtual Value eval(Number &rhs);
 
-    virtual BaseType *eval(Complex &rhs);
+    virtual Value eval(Complex &rhs);
 
-    virtual BaseType *eval(List &rhs);
+    virtual Value eval(List &rhs);
 
-    virtual BaseType *eval(ComplexList &rhs);
+    virtual Value eval(ComplexList &rhs);
 
-    virtual BaseType *eval(String &rhs);
+    virtual Value eval(String &rhs);
 
-    virtual BaseType *eval(Matrix &rhs);
+    virtual Value eval(Matrix &rhs);
 };
 
 class FuncRound : public UnaryFunction {
-    BaseType * eval(Number &rhs) override;
+    Value eval(Number &rhs) override;
+
+    Value eval(Complex &rhs) override;
+
+    Value eval(Matrix &rhs) override;
+};
 
-    BaseType * eval(Complex &rhs) override;
+class FuncDet : public UnaryFunction {
+    Value eval(Matrix &rhs) override;
+};
+
+class FuncRef : public UnaryFunction {
+    Value eval(Matrix &rhs) override;
+};
 
-    BaseType * eval(Matrix &rhs) override;
+class FuncRref : public UnaryFunction {
+    Value eval(Matrix &rhs) override;
 };
 
 class FuncSin : public UnaryFunction {
-    BaseType * eval(Number &rhs) override;
+    Value eval(Number &rhs) override;
+
+    Value eval(List &rhs) override;
 };
 
 class FuncCos : public UnaryFunction {
-    BaseType * eval(Number &rhs) override;
+    Value eval(Number &rhs) override;
+
+    Value eval(List &rhs) override;
 };
 
 class FuncTan : public UnaryFunction {
-    BaseType * eval(Number &rhs) override;
+    Value eval(Number &rhs) override;
+
+    Value eval(List &rhs) override;
 };
 
-BaseType *evalFunction(struct NODE *evalNode);
+// Functions with a 2-byte token are stored as the first byte plus the second byte shifted left by 8, just like the
+// elements of lists and matrices
+#define FUNC_REF (OS_TOK_2BYTE + (0x2D << 8))
+#define FUNC_RREF (OS_TOK_2BYTE + (0x2E << 8))
+
+// Maximum number of arguments a function or command can have
+#define MAX_ARGS 10
+
+UnaryFunction *getUnaryFunction(unsigned int func);
+
+Value callFunction(unsigned int func, Value *args, unsigned int argc);
+
+Value stringLiteral(const struct var_string *string);
+
+Value evalFunction(struct NODE *evalNode);
 
 #endif
@@ -0,0 +1,297 @@
+#include "linalg.h"
+#include "errors.h"
+#include "pool.h"
+#include "scratch.h"
+#include "stats.h"
+
+#include <cmath>
+#include <cstring>
+
+// Pivots which are this small relative to the largest element of the matrix are rounding errors of a 0
+#define PIVOT_EPSILON 1e-6f
+
+/**
+ * Only the last factorization is kept, which is enough for the common case of a matrix which is inverted and used to
+ * solve a system, or whose determinant is checked first. The factored matrix is retained, so it can't change in place
+ * as long as it's kept: anything that writes to it gets its own copy instead. Temporaries aren't kept, as they would
+ * keep the scratch arena from being reset.
+ */
+static struct lu_factors factors;
+static size_t factorsSize;      // Size of the block with the elements and the permutation
+
+// The largest absolute value of the elements, which is the scale for the pivots
+static float largestElement(const float *elements, unsigned int count) {
+    float largest = 0;
+
+    for (unsigned int i = 0; i < count; i++) {
+        float value = fabsf(elements[i]);
+
+        if (value > largest) largest = value;
+    }
+
+    return largest;
+}
+
+// Finds the row with the largest absolute value in a column, which is the most stable pivot
+static uint8_t findPivot(const float *elements, uint8_t rows, uint8_t cols, uint8_t col, uint8_t fromRow) {
+    uint8_t pivot = fromRow;
+    float largest = fabsf(elements[fromRow * cols + col]);
+
+    for (uint8_t row = fromRow + 1; row < rows; row++) {
+        float value = fabsf(elements[row * cols + col]);
+
+        if (value > largest) {
+            largest = value;
+            pivot = row;
+        }
+    }
+
+    return pivot;
+}
+
+static void swapRows(float *elements, uint8_t cols, uint8_t row1, uint8_t row2) {
+    float *first = elements + row1 * cols;
+    float *second = elements + row2 * cols;
+
+    for (uint8_t col = 0; col < cols; col++) {
+        float tmp = first[col];
+
+        first[col] = second[col];
+        second[col] = tmp;
+    }
+}
+
+/**
+ * Factors a square matrix. If it's the same matrix as last time, the factors are reused.
+ * @param matrix Matrix to factor
+ * @return The factors, which stay valid until the next call
+ */
+const struct lu_factors &factorLU(Matrix &matrix) {
+    if (!matrix.rows || matrix.rows != matrix.cols) dimensionError();
+
+    if (factors.matrix == &matrix) {
+        STATS_COUNT(luReuses, 1);
+        return factors;
+    }
+
+    uint8_t size = matrix.rows;
+    unsigned int count = matrix.size();
+    size_t blockSize = count * sizeof(float) + size;
+
+    if (factors.matrix != nullptr) release(factors.matrix);
+
+    if (blockSize != factorsSize) {
+        poolFree(factors.elements, factorsSize);
+        factors.elements = static_cast<float *>(poolAlloc(blockSize));
+        factors.permutation = reinterpret_cast<uint8_t *>(factors.elements + count);
+        factorsSize = blockSize;
+    }
+
+    factors.matrix = inScratch(&matrix) ? nullptr : retain(&matrix);
+    factors.size = size;
+    factors.singular = false;
+    factors.oddPermutation = false;
+
+    float *elements = factors.elements;
+    float tolerance = largestElement(matrix.elements, count) * PIVOT_EPSILON;
+
+    memcpy(elements, matrix.elements, count * sizeof(float));
+    for (uint8_t row = 0; row < size; row++) {
+        factors.permutation[row] = row;
+    }
+
+    STATS_COUNT(luFactorizations, 1);
+
+    for (uint8_t col = 0; col < size; col++) {
+        uint8_t pivot = findPivot(elements, size, size, col, col);
+
+        if (fabsf(elements[pivot * size + col]) <= tolerance) {
+            factors.singular = true;
+            break;
+        }
+
+        if (pivot != col) {
+            uint8_t tmp = factors.permutation[col];
+
+            swapRows(elements, size, col, pivot);
+            factors.permutation[col] = factors.permutation[pivot];
+            factors.permutation[pivot] = tmp;
+            factors.oddPermutation = !factors.oddPermutation;
+        }
+
+        // Divisions are much slower than multiplications, so only do one per column
+        const float *pivotRow = elements + col * size;
+        float reciprocal = 1 / pivotRow[col];
+
+        for (uint8_t row = col + 1; row < size; row++) {
+            float *current = elements + row * size;
+            float factor = current[col] * reciprocal;
+
+            current[col] = factor;
+            if (factor == 0) continue;
+
+            for (uint8_t i = col + 1; i < size; i++) {
+                current[i] -= factor * pivotRow[i];
+            }
+        }
+    }
+
+    return factors;
+}
+
+float determinant(Matrix &matrix) {
+    const struct lu_factors &lu = factorLU(matrix);
+
+    if (lu.singular) return 0;
+
+    float result = lu.oddPermutation ? -1 : 1;
+
+    for (uint8_t i = 0; i < lu.size; i++) {
+        result *= lu.elements[i * lu.size + i];
+    }
+
+    return result;
+}
+
+/**
+ * Solves LUX = PB, which is the same as AX = B. The rows are processed as a whole, so every column of B is solved at
+ * once.
+ * @param lu The factors of A
+ * @param x PB, which is overwritten with X
+ */
+static void substitute(const struct lu_factors &lu, Matrix &x) {
+    uint8_t size = lu.size;
+    uint8_t cols = x.cols;
+
+    // Forward substitution with L, which has ones on its diagonal
+    for (uint8_t row = 1; row < size; row++) {
+        float *current = &x.at(row, 0);
+
+        for (uint8_t k = 0; k < row; k++) {
+            float factor = lu.elements[row * size + k];
+            const float *source = &x.at(k, 0);
+
+            if (factor == 0) continue;
+
+            for (uint8_t col = 0; col < cols; col++) {
+                current[col] -= factor * source[col];
+            }
+        }
+    }
+
+    // Back substitution with U
+    for (uint8_t row = size; row-- > 0;) {
+        float *current = &x.at(row, 0);
+
+        for (uint8_t k = row + 1; k < size; k++) {
+            float factor = lu.elements[row * size + k];
+            const float *source = &x.at(k, 0);
+
+            if (factor == 0) continue;
+
+            for (uint8_t col = 0; col < cols; col++) {
+                current[col] -= factor * source[col];
+            }
+        }
+
+        float reciprocal = 1 / lu.elements[row * size + row];
+
+        for (uint8_t col = 0; col < cols; col++) {
+            current[col] *= reciprocal;
+        }
+    }
+}
+
+Matrix *invert(Matrix &matrix) {
+    const struct lu_factors &lu = factorLU(matrix);
+
+    if (lu.singular) singularMatrixError();
+
+    // Solve AX = I, where PI has a single 1 in every row
+    Matrix *result = Matrix::create(lu.size, lu.size);
+
+    memset(result->elements, 0, result->size() * sizeof(float));
+    for (uint8_t row = 0; row < lu.size; row++) {
+        result->at(row, lu.permutation[row]) = 1;
+    }
+
+    substitute(lu, *result);
+
+    return result;
+}
+
+/**
+ * Solves the system lhs * X = rhs, which is [A]⁻¹[B] without calculating the inverse of [A] itself
+ * @return X
+ */
+Matrix *solve(Matrix &lhs, Matrix &rhs) {
+    const struct lu_factors &lu = factorLU(lhs);
+
+    if (rhs.rows != lu.size) dimensionMismatch();
+    if (lu.singular) singularMatrixError();
+
+    Matrix *result = Matrix::create(rhs.rows, rhs.cols);
+
+    for (uint8_t row = 0; row < lu.size; row++) {
+        memcpy(&result->at(row, 0), &rhs.at(lu.permutation[row], 0), rhs.cols * sizeof(float));
+    }
+
+    substitute(lu, *result);
+
+    return result;
+}
+
+/**
+ * Brings a matrix in row echelon form with Gaussian elimination and partial pivoting, like ref(, so that every row
+ * starts with a 1. If reduced, like rref(, the column of each leading 1 is 0 in all other rows as well.
+ */
+Matrix *rowEchelon(Matrix &matrix, bool reduced) {
+    if (!matrix.size() || matrix.cols < matrix.rows) dimensionError();
+
+    Matrix *result = Matrix::createResult(matrix);
+    uint8_t rows = matrix.rows;
+    uint8_t cols = matrix.cols;
+    float *elements = result->elements;
+    float tolerance = largestElement(matrix.elements, matrix.size()) * PIVOT_EPSILON;
+    uint8_t pivotRow = 0;
+
+    if (result != &matrix) memcpy(elements, matrix.elements, matrix.size() * sizeof(float));
+
+    for (uint8_t col = 0; col < cols && pivotRow < rows; col++) {
+        uint8_t pivot = findPivot(elements, rows, cols, col, pivotRow);
+
+        // Nothing left to eliminate in this column, apart from rounding errors
+        if (fabsf(elements[pivot * cols + col]) <= tolerance) {
+            for (uint8_t row = pivotRow; row < rows; row++) {
+                elements[row * cols + col] = 0;
+            }
+            continue;
+        }
+
+        if (pivot != pivotRow) swapRows(elements, cols, pivotRow, pivot);
+
+        float *leading = elements + pivotRow * cols;
+        float reciprocal = 1 / leading[col];
+
+        leading[col] = 1;
+        for (uint8_t i = col + 1; i < cols; i++) {
+            leading[i] *= reciprocal;
+        }
+
+        for (uint8_t row = reduced ? 0 : pivotRow + 1; row < rows; row++) {
+            float *current = elements + row * cols;
+            float factor = current[col];
+
+            if (row == pivotRow || factor == 0) continue;
+
+            current[col] = 0;
+            for (uint8_t i = col + 1; i < cols; i++) {
+                current[i] -= factor * leading[i];
+            }
+        }
+
+        pivotRow++;
+    }
+
+    return result;
+}
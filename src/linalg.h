@@ -0,0 +1,32 @@
+#ifndef LINALG_H
+#define LINALG_H
+
+#include "types.h"
+
+#include <cstdint>
+
+/**
+ * The LU decomposition of a square matrix A, with partial pivoting: the rows of A are permuted such that PA = LU, where
+ * L is lower triangular with ones on its diagonal, and U is upper triangular. Both are stored in a single flat buffer
+ * in row-major order, L below the diagonal and U on and above it.
+ */
+struct lu_factors {
+    Matrix *matrix;             // The factored matrix, or nullptr if it was a temporary
+    uint8_t size;
+    bool singular;
+    bool oddPermutation;        // Whether an odd number of rows was swapped, which flips the sign of the determinant
+    uint8_t *permutation;       // Row i of PA is row permutation[i] of A
+    float *elements;
+};
+
+const struct lu_factors &factorLU(Matrix &matrix);
+
+float determinant(Matrix &matrix);
+
+Matrix *invert(Matrix &matrix);
+
+Matrix *solve(Matrix &lhs, Matrix &rhs);
+
+Matrix *rowEchelon(Matrix &matrix, bool reduced);
+
+#endif
@@ -1,9 +1,14 @@
+#include "bench.h"
+#include "compile.h"
 #include "evaluate.h"
 #include "errors.h"
 #include "globals.h"
 #include "parse.h"
 #include "variables.h"
 #include "main.h"
+#include "optimize.h"
+#include "stats.h"
+#include "utils.h"
 
 #include <fileioc.h>
 #include <fontlibc.h>
@@ -86,11 +91,39 @@ int main(int argc, char *argv[]) {
     globals = Globals();
     std::set_new_handler(memoryError);
 
-    auto root = parseProgram(input_slot, false, false);
+    // The tokenizer walks the program data directly, so the slot isn't needed anymore afterwards
+    tokenInit((const uint8_t *) ti_GetDataPtr(input_slot), ti_GetSize(input_slot));
+    ti_Close(input_slot);
+
+    STATS_START(parse);
+    auto root = parseProgram(false, false);
+    optimizeProgram(root);
+    STATS_STOP(parse);
+
+    // Building with -DTREE_WALKER evaluates the AST directly, which is slower, but useful to compare the results of
+    // the bytecode interpreter against
+#ifdef TREE_WALKER
+    STATS_START(run);
     evalNodes(root);
+    STATS_STOP(run);
+#else
+    STATS_START(compile);
+    auto code = compileProgram(root);
+    STATS_STOP(compile);
+
+    STATS_START(run);
+    runProgram(code);
+    STATS_STOP(run);
+#endif
+
+    writeVariablesToOS();
+    writeAnsToOS();
 
     fontlib_DrawString("                      Done");
 
+    printStats();
+    benchmarkMatrices();
+
     while (!os_GetCSC());
 
     gfx_End();
@@ -3,12 +3,21 @@
 #include "errors.h"
 #include "evaluate.h"
 #include "globals.h"
+#include "linalg.h"
+#include "stats.h"
 #include "utils.h"
+#include "variables.h"
 
 #include <cmath>
 #include <cstring>
 #include <tice.h>
 
+// Products of two integers up to this size still fit in INT_NUMBER_LIMIT
+#define INT_MUL_LIMIT 0x7FF
+
+// Like the OS, a matrix can be raised to a power up to this
+#define MAX_MATRIX_POWER 255
+
 // https://education.ti.com/html/webhelp/EG_TI84PlusCE/EN/content/eg_gsguide/m_expressions/exp_order_of_operations.HTML
 // Commas are treated as a special operator, which means that if the token is a comma, all other operators will be
 // moved properly to the output. It is also "right-associative", which means that if the top stack entry is also a
@@ -42,6 +51,31 @@ static const uint8_t precedence[] = {
         255
 };
 
+// The operators don't have any state, so a single instance of each is enough
+static OpFromRad opFromRad;
+static OpFromDeg opFromDeg;
+static OpRecip opRecip;
+static OpSqr opSqr;
+static OpTrnspos opTrnspos;
+static OpCube opCube;
+static OpFact opFact;
+static OpChs opChs;
+static OpPower opPower;
+static OpMul opMul;
+static OpDiv opDiv;
+static OpAdd opAdd;
+static OpSub opSub;
+static OpEQ opEQ;
+static OpLT opLT;
+static OpGT opGT;
+static OpLE opLE;
+static OpGE opGE;
+static OpNE opNE;
+static OpAnd opAnd;
+static OpOr opOr;
+static OpXor opXor;
+static OpSolve opSolve;
+
 uint8_t getOpPrecedence(uint8_t op) {
     void *index = memchr(operators, op, sizeof(operators));
 
@@ -52,266 +86,588 @@ bool isUnaryOp(uint8_t prec) {
     return prec <= 4 && prec != 2;
 }
 
-BaseType *evalOperator(struct NODE *node) {
-    uint8_t op = node->data.operand.op;
-    BaseType *leftNode = evalNode(node->child);
-    BaseType *result;
-
-    if (isUnaryOp(getOpPrecedence(op))) {
-        UnaryOperator *opNew;
-
-        switch (op) {
-            case OS_TOK_FROM_RAD:
-                opNew = new OpFromRad();
-                break;
-            case OS_TOK_FROM_DEG:
-                opNew = new OpFromDeg();
-                break;
-            case OS_TOK_RECIPROCAL:
-                opNew = new OpRecip();
-                break;
-            case OS_TOK_SQRT:
-                opNew = new OpSqr();
-                break;
-            case OS_TOK_TRANSPOSE:
-                opNew = new OpTrnspos();
-                break;
-            case OS_TOK_CUBE:
-                opNew = new OpCube();
-                break;
-            case OS_TOK_EXCLAIM:
-                opNew = new OpFact();
-                break;
-            case OS_TOK_NEGATIVE:
-                opNew = new OpChs();
-                break;
-            default:
-                typeError();
-        }
+UnaryOperator *getUnaryOperator(uint8_t op) {
+    switch (op) {
+        case OS_TOK_FROM_RAD:
+            return &opFromRad;
+        case OS_TOK_FROM_DEG:
+            return &opFromDeg;
+        case OS_TOK_RECIPROCAL:
+            return &opRecip;
+        case OS_TOK_SQRT:
+            return &opSqr;
+        case OS_TOK_TRANSPOSE:
+            return &opTrnspos;
+        case OS_TOK_CUBE:
+            return &opCube;
+        case OS_TOK_EXCLAIM:
+            return &opFact;
+        case OS_TOK_NEGATIVE:
+            return &opChs;
+        default:
+            return nullptr;
+    }
+}
 
-        result = leftNode->eval(*opNew);
+Value evalUnaryOperator(UnaryOperator *op, Value &rhs) {
+    if (op == nullptr) typeError();
+
+    return rhs.eval(*op);
+}
+
+BinaryOperator *getBinaryOperator(uint8_t op) {
+    switch (op) {
+        case OS_TOK_POWER:
+            return &opPower;
+        case OS_TOK_MULTIPLY:
+            return &opMul;
+        case OS_TOK_DIVIDE:
+            return &opDiv;
+        case OS_TOK_ADD:
+            return &opAdd;
+        case OS_TOK_SUBTRACT:
+            return &opSub;
+        case OS_TOK_EQUAL:
+            return &opEQ;
+        case OS_TOK_LESS_THAN:
+            return &opLT;
+        case OS_TOK_GREATER_THAN:
+            return &opGT;
+        case OS_TOK_LESS_THAN_EQUAL:
+            return &opLE;
+        case OS_TOK_GREATER_THAN_EQUAL:
+            return &opGE;
+        case OS_TOK_NOT_EQUAL:
+            return &opNE;
+        case OS_TOK_AND:
+            return &opAnd;
+        case OS_TOK_OR:
+            return &opOr;
+        case OS_TOK_XOR:
+            return &opXor;
+        default:
+            return nullptr;
+    }
+}
 
-        delete opNew;
-    } else {
-        BaseType *rightNode;
-        BinaryOperator *opNew;
+// The optimizer replaces the multiplication in [A]⁻¹[B] by this operator, which doesn't need the inverse itself
+BinaryOperator *getSolveOperator() {
+    return &opSolve;
+}
+
+// The arithmetic on two real numbers. The operators use these for their real overloads, and the operators which the
+// type inference specialized call them directly, without going through the virtual dispatch of Value::eval.
+Number realMul(const Number &lhs, const Number &rhs) {
+    if (lhs.isInt && rhs.isInt && lhs.intNum >= -INT_MUL_LIMIT && lhs.intNum <= INT_MUL_LIMIT &&
+        rhs.intNum >= -INT_MUL_LIMIT && rhs.intNum <= INT_MUL_LIMIT) {
+        return Number::fromInt(lhs.intNum * rhs.intNum);
+    }
+
+    return Number(lhs.num * rhs.num);
+}
+
+Number realDiv(const Number &lhs, const Number &rhs) {
+    if (rhs.num == 0) divideBy0Error();
+
+    return Number(lhs.num / rhs.num);
+}
+
+Number realAdd(const Number &lhs, const Number &rhs) {
+    if (lhs.isInt && rhs.isInt) return Number::fromInt(lhs.intNum + rhs.intNum);
+
+    return Number(lhs.num + rhs.num);
+}
+
+Number realSub(const Number &lhs, const Number &rhs) {
+    if (lhs.isInt && rhs.isInt) return Number::fromInt(lhs.intNum - rhs.intNum);
+
+    return Number(lhs.num - rhs.num);
+}
+
+Number realEQ(const Number &lhs, const Number &rhs) {
+    if (lhs.isInt && rhs.isInt) return Number::fromBool(lhs.intNum == rhs.intNum);
+
+    return Number::fromBool(lhs.num == rhs.num);
+}
+
+Number realLT(const Number &lhs, const Number &rhs) {
+    if (lhs.isInt && rhs.isInt) return Number::fromBool(lhs.intNum < rhs.intNum);
+
+    return Number::fromBool(lhs.num < rhs.num);
+}
 
-        if (op == OS_TOK_STO) {
+Number realGT(const Number &lhs, const Number &rhs) {
+    if (lhs.isInt && rhs.isInt) return Number::fromBool(lhs.intNum > rhs.intNum);
+
+    return Number::fromBool(lhs.num > rhs.num);
+}
+
+Number realLE(const Number &lhs, const Number &rhs) {
+    if (lhs.isInt && rhs.isInt) return Number::fromBool(lhs.intNum <= rhs.intNum);
+
+    return Number::fromBool(lhs.num <= rhs.num);
+}
+
+Number realGE(const Number &lhs, const Number &rhs) {
+    if (lhs.isInt && rhs.isInt) return Number::fromBool(lhs.intNum >= rhs.intNum);
+
+    return Number::fromBool(lhs.num >= rhs.num);
+}
+
+Number realNE(const Number &lhs, const Number &rhs) {
+    if (lhs.isInt && rhs.isInt) return Number::fromBool(lhs.intNum != rhs.intNum);
+
+    return Number::fromBool(lhs.num != rhs.num);
+}
+
+Number evalRealOperator(uint8_t op, const Number &lhs, const Number &rhs) {
+    switch (op) {
+        case OS_TOK_ADD:
+            return realAdd(lhs, rhs);
+        case OS_TOK_SUBTRACT:
+            return realSub(lhs, rhs);
+        case OS_TOK_MULTIPLY:
+            return realMul(lhs, rhs);
+        case OS_TOK_DIVIDE:
+            return realDiv(lhs, rhs);
+        case OS_TOK_EQUAL:
+            return realEQ(lhs, rhs);
+        case OS_TOK_NOT_EQUAL:
+            return realNE(lhs, rhs);
+        case OS_TOK_LESS_THAN:
+            return realLT(lhs, rhs);
+        case OS_TOK_GREATER_THAN:
+            return realGT(lhs, rhs);
+        case OS_TOK_LESS_THAN_EQUAL:
+            return realLE(lhs, rhs);
+        case OS_TOK_GREATER_THAN_EQUAL:
+            return realGE(lhs, rhs);
+        default:
             typeError();
+    }
+}
+
+// Evaluates a fused expression operator by operator, for leaves which are not all real numbers or lists
+static Value evalFusedGeneric(const struct fused_expr *fused, Value *leaves) {
+    Value stack[FUSED_MAX_DEPTH];
+    unsigned int sp = 0;
+    unsigned int leaf = 0;
+
+    for (unsigned int i = 0; i < fused->length; i++) {
+        uint8_t op = fused->code[i];
+
+        if (op == FUSED_LEAF) {
+            stack[sp++] = static_cast<Value &&>(leaves[leaf++]);
+        } else if (op == OS_TOK_NEGATIVE) {
+            stack[sp - 1] = evalUnaryOperator(getUnaryOperator(op), stack[sp - 1]);
         } else {
-            rightNode = evalNode(node->child->next);
+            sp--;
+            stack[sp - 1] = evalBinaryOperator(getBinaryOperator(op), stack[sp - 1], stack[sp]);
+            stack[sp].clear();
+        }
+    }
 
-            switch (op) {
-                case OS_TOK_POWER:
-                    opNew = new OpPower();
-                    break;
-                case OS_TOK_MULTIPLY:
-                    opNew = new OpMul();
+    return static_cast<Value &&>(stack[0]);
+}
+
+/**
+ * Evaluates an element-wise list expression in a single loop over the elements, so that no intermediate lists are
+ * created. If a leaf is not a real number or list, or none is a list, the operators are applied one by one instead.
+ * @param fused The expression
+ * @param leaves The values of its leaves, which are all cleared afterwards
+ * @return The resulting value
+ */
+Value evalFused(const struct fused_expr *fused, Value *leaves) {
+    const float *sources[FUSED_MAX_LEAVES];
+    unsigned int steps[FUSED_MAX_LEAVES];
+    unsigned int length = 0;
+    bool hasList = false;
+    List *temporary = nullptr;
+
+    for (unsigned int i = 0; i < fused->leaves; i++) {
+        Value &leaf = leaves[i];
+
+        if (leaf.type == TypeType::LIST) {
+            if (!leaf.list->length) dimensionError();
+            if (hasList && leaf.list->length != length) dimensionMismatch();
+
+            // Every element only depends on the same element of the leaves, so a temporary leaf can hold the result
+            if (temporary == nullptr && leaf.list->refCount == 1) temporary = leaf.list;
+
+            sources[i] = leaf.list->elements;
+            steps[i] = 1;
+            length = leaf.list->length;
+            hasList = true;
+        } else if (leaf.type == TypeType::NUMBER) {
+            sources[i] = &leaf.number.num;
+            steps[i] = 0;
+        } else {
+            hasList = false;
+            break;
+        }
+    }
+
+    if (!hasList) return evalFusedGeneric(fused, leaves);
+
+    List *result = temporary != nullptr ? List::createResult(*temporary) : List::create(length);
+
+    for (unsigned int i = 0; i < length; i++) {
+        float stack[FUSED_MAX_DEPTH];
+        unsigned int sp = 0;
+        unsigned int leaf = 0;
+
+        for (unsigned int j = 0; j < fused->length; j++) {
+            switch (fused->code[j]) {
+                case FUSED_LEAF:
+                    stack[sp++] = *sources[leaf++];
                     break;
-                case OS_TOK_DIVIDE:
-                    opNew = new OpDiv();
+                case OS_TOK_NEGATIVE:
+                    stack[sp - 1] = -stack[sp - 1];
                     break;
                 case OS_TOK_ADD:
-                    opNew = new OpAdd();
+                    sp--;
+                    stack[sp - 1] += stack[sp];
                     break;
                 case OS_TOK_SUBTRACT:
-                    opNew = new OpSub();
-                    break;
-                case OS_TOK_EQUAL:
-                    opNew = new OpEQ();
-                    break;
-                case OS_TOK_LESS_THAN:
-                    opNew = new OpLT();
-                    break;
-                case OS_TOK_GREATER_THAN:
-                    opNew = new OpGT();
-                    break;
-                case OS_TOK_LESS_THAN_EQUAL:
-                    opNew = new OpLE();
-                    break;
-                case OS_TOK_GREATER_THAN_EQUAL:
-                    opNew = new OpGE();
-                    break;
-                case OS_TOK_NOT_EQUAL:
-                    opNew = new OpNE();
-                    break;
-                case OS_TOK_AND:
-                    opNew = new OpAnd();
-                    break;
-                case OS_TOK_OR:
-                    opNew = new OpOr();
-                    break;
-                case OS_TOK_XOR:
-                    opNew = new OpXor();
+                    sp--;
+                    stack[sp - 1] -= stack[sp];
                     break;
                 default:
-                    typeError();
+                    sp--;
+                    stack[sp - 1] *= stack[sp];
+                    break;
             }
+        }
+
+        result->elements[i] = stack[0];
+
+        // Numbers have a step of 0, so they are used for every element
+        for (unsigned int j = 0; j < fused->leaves; j++) {
+            sources[j] += steps[j];
+        }
+    }
+
+    for (unsigned int i = 0; i < fused->leaves; i++) {
+        leaves[i].clear();
+    }
+
+    return result;
+}
+
+Value evalBinaryOperator(BinaryOperator *op, Value &lhs, Value &rhs) {
+    if (op == nullptr) typeError();
+
+    return lhs.eval(*op, rhs);
+}
+
+Value evalOperator(struct NODE *node) {
+    const struct op_t &op = node->data.operand.op;
+    Value leftNode = evalNode(getNode(node->child));
+
+    if (isUnaryOp(op.precedence)) return evalUnaryOperator(op.handler.unary, leftNode);
+
+    // The right side of a store is the variable itself, which shouldn't be evaluated, apart from the indices of an
+    // element
+    if (op.token == OS_TOK_STO) {
+        struct NODE *var = getNode(getNode(node->child)->next);
+
+        if (var->data.type == ET_VARIABLE) {
+            storeVariable(var->data.operand.variableNr, leftNode);
+        } else if (var->data.type == ET_LIST_ELEMENT) {
+            Value index = evalNode(getNode(var->child));
+
+            storeListElement(var->data.operand.listNr, index, leftNode);
+        } else if (var->data.type == ET_MATRIX_ELEMENT) {
+            Value row = evalNode(getNode(var->child));
+            Value col = evalNode(getNode(getNode(var->child)->next));
+
+            storeMatrixElement(var->data.operand.matrixNr, row, col, leftNode);
+        } else {
+            typeError();
+        }
+
+        return leftNode;
+    }
+
+    Value rightNode = evalNode(getNode(getNode(node->child)->next));
+
+    // Deoptimize if a variable turned out to be complex after all
+    if (op.real && leftNode.type == TypeType::NUMBER && rightNode.type == TypeType::NUMBER) {
+        return evalRealOperator(op.token, leftNode.number, rightNode.number);
+    }
+    if (op.real) STATS_COUNT(deoptimizations, 1);
+
+    return evalBinaryOperator(op.handler.binary, leftNode, rightNode);
+}
+
+// Whether an exponent is an integer, which is small enough to raise something to its power by repeated squaring
+static bool integerExponent(const Number &number, int &exponent) {
+    if (number.isInt) {
+        exponent = number.intNum;
+    } else if (fabsf(number.num) <= INT_NUMBER_LIMIT && number.num == (float) (int) number.num) {
+        exponent = (int) number.num;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// The largest power of 2 which is not larger than the exponent
+static unsigned int highestBit(unsigned int exponent) {
+    unsigned int bit = 1;
+
+    while (bit <= exponent >> 1) {
+        bit <<= 1;
+    }
+
+    return bit;
+}
+
+// Integers up to 2^24 are exact as a float
+#define EXACT_FLOAT_LIMIT 16777216.0f
+
+static inline float multiply(float lhs, float rhs) {
+    return lhs * rhs;
+}
+
+static inline Complex multiply(const Complex &lhs, const Complex &rhs) {
+    return Complex(lhs.real * rhs.real - lhs.imag * rhs.imag, lhs.real * rhs.imag + lhs.imag * rhs.real);
+}
+
+/**
+ * Raises a number to a positive integer power with O(log N) multiplications. Every multiplication rounds, so for real
+ * numbers this is only used when all of them are exact, and powf is more accurate otherwise. The bits of the exponent
+ * are walked from the top, so the base itself is multiplied in, and the result doesn't have to start at 1.
+ */
+template<typename T>
+static T powerBySquaring(const T &base, unsigned int exponent) {
+    T result = base;
+
+    for (unsigned int bit = highestBit(exponent) >> 1; bit; bit >>= 1) {
+        result = multiply(result, result);
+        if (exponent & bit) result = multiply(result, base);
+    }
+
+    return result;
+}
+
+/**
+ * The same for a square matrix, where every step is written into the other of two buffers, so no matrix is allocated
+ * while squaring
+ */
+static Matrix *matrixPower(Matrix &base, unsigned int exponent) {
+    if (!base.size() || base.rows != base.cols) dimensionError();
 
-            result = leftNode->eval(*opNew, rightNode);
+    Matrix *result = Matrix::create(base.rows, base.cols);
 
-            delete opNew;
-            delete rightNode;
+    if (exponent == 0) {
+        memset(result->elements, 0, result->size() * sizeof(float));
+        for (uint8_t i = 0; i < base.rows; i++) {
+            result->at(i, i) = 1;
+        }
+
+        return result;
+    }
+
+    Matrix *other = Matrix::create(base.rows, base.cols);
+
+    memcpy(result->elements, base.elements, base.size() * sizeof(float));
+
+    for (unsigned int bit = highestBit(exponent) >> 1; bit; bit >>= 1) {
+        multiplyMatricesInto(*other, *result, *result);
+        if (exponent & bit) {
+            multiplyMatricesInto(*result, *other, base);
+        } else {
+            Matrix *tmp = result;
+
+            result = other;
+            other = tmp;
         }
     }
 
-    delete leftNode;
+    delete other;
 
     return result;
 }
 
-BaseType *OpFromRad::eval(Number &rhs) {
+Value OpFromRad::eval(Number &rhs) {
     if (globals.inRadianMode) {
-        return new Number(rhs.num);
+        return Number(rhs.num);
     }
 
-    return new Number(rhs.num * 180 / M_PI);
+    return Number(rhs.num * 180 / M_PI);
 }
 
-BaseType *OpFromDeg::eval(Number &rhs) {
+Value OpFromDeg::eval(Number &rhs) {
     if (globals.inRadianMode) {
-        return new Number(rhs.num * M_PI / 180);
+        return Number(rhs.num * M_PI / 180);
     }
 
-    return new Number(rhs.num);
+    return Number(rhs.num);
 }
 
-BaseType *OpRecip::eval(Number &rhs) {
+Value OpRecip::eval(Number &rhs) {
     if (rhs.num == 0) divideBy0Error();
 
-    return new Number(1 / rhs.num);
+    return Number(1 / rhs.num);
 }
 
-BaseType *OpRecip::eval(Complex &rhs) {
+Value OpRecip::eval(Complex &rhs) {
     // 1 / (a + bi) = (a - bi) / (a² + b²)
     float denom = rhs.real * rhs.real + rhs.imag * rhs.imag;
 
     if (denom == 0) divideBy0Error();
 
-    return new Complex(rhs.real / denom, rhs.imag / -denom);
+    return Complex(rhs.real / denom, rhs.imag / -denom);
 }
 
-BaseType *OpRecip::eval(__attribute__((unused)) Matrix &rhs) {
-    // todo: matrix inversion
-    typeError();
+Value OpRecip::eval(Matrix &rhs) {
+    return invert(rhs);
 }
 
-BaseType *OpSqr::eval(Number &rhs) {
-    return new Number(rhs.num * rhs.num);
+Value OpSqr::eval(Number &rhs) {
+    if (rhs.isInt && rhs.intNum >= -INT_MUL_LIMIT && rhs.intNum <= INT_MUL_LIMIT) {
+        return Number::fromInt(rhs.intNum * rhs.intNum);
+    }
+
+    return Number(rhs.num * rhs.num);
 }
 
-BaseType *OpSqr::eval(Complex &rhs) {
+Value OpSqr::eval(Complex &rhs) {
     // (a + bi)² = a² - b² + 2abi
-    return new Complex(rhs.real * rhs.real - rhs.imag * rhs.imag, rhs.real * rhs.imag * 2);
+    return Complex(rhs.real * rhs.real - rhs.imag * rhs.imag, rhs.real * rhs.imag * 2);
 }
 
-BaseType *OpSqr::eval(Matrix &rhs) {
+Value OpSqr::eval(Matrix &rhs) {
     return multiplyMatrices(rhs, rhs);
 }
 
-BaseType *OpTrnspos::eval(Matrix &rhs) {
-    if (rhs.elements.empty()) dimensionError();
-    if (rhs.elements[0].empty()) dimensionError();
+Value OpTrnspos::eval(Matrix &rhs) {
+    if (!rhs.size()) dimensionError();
 
-    vector<vector<Number>> newElements(rhs.elements[0].size(), vector<Number>(rhs.elements.size()));
+    Matrix *result = Matrix::create(rhs.cols, rhs.rows);
 
-    for (unsigned int row = 0; row < rhs.elements.size(); row++) {
-        for (unsigned int col = 0; col < rhs.elements[0].size(); col++) {
-            newElements[col][row] = rhs.elements[row][col];
+    for (uint8_t row = 0; row < rhs.rows; row++) {
+        for (uint8_t col = 0; col < rhs.cols; col++) {
+            result->at(col, row) = rhs.at(row, col);
         }
     }
 
-    return new Matrix(newElements);
+    return result;
 }
 
-BaseType *OpCube::eval(Number &rhs) {
-    return new Number(rhs.num * rhs.num * rhs.num);
+Value OpCube::eval(Number &rhs) {
+    return Number(rhs.num * rhs.num * rhs.num);
 }
 
-BaseType *OpCube::eval(Complex &rhs) {
+Value OpCube::eval(Complex &rhs) {
     // (a + bi)³ = a³ - 3ab² + (3a²b - b³)i
     float realSqr = rhs.real * rhs.real;
     float imagSqr = rhs.imag * rhs.imag;
 
-    return new Complex(rhs.real * (realSqr - 3 * imagSqr), rhs.imag * (3 * realSqr - imagSqr));
+    return Complex(rhs.real * (realSqr - 3 * imagSqr), rhs.imag * (3 * realSqr - imagSqr));
 }
 
-BaseType *OpCube::eval(Matrix &rhs) {
-    auto matrixSquare = multiplyMatrices(rhs, rhs);
-    auto matrixCube = multiplyMatrices(*matrixSquare, rhs);
+Value OpCube::eval(Matrix &rhs) {
+    return matrixPower(rhs, 3);
+}
 
-    delete matrixSquare;
+Value OpPower::eval(Number &lhs, Number &rhs) {
+    int exponent;
 
-    return matrixCube;
-}
+    if (!integerExponent(rhs, exponent)) return Number(powf(lhs.num, rhs.num));
+    if (exponent == 0) return Number::fromInt(1);
+    if (exponent < 0 && lhs.num == 0) divideBy0Error();
+
+    // The powers of an integer are integers, so squaring is exact as long as the result fits in the mantissa of a float
+    if (lhs.isInt || (fabsf(lhs.num) <= INT_NUMBER_LIMIT && lhs.num == (float) (int) lhs.num)) {
+        float result = powerBySquaring(lhs.num, exponent < 0 ? -exponent : exponent);
 
-BaseType *OpPower::eval(Number &lhs, Number &rhs) {
-    return new Number(powf(lhs.num, rhs.num));
+        if (fabsf(result) <= EXACT_FLOAT_LIMIT) {
+            if (exponent < 0) return Number(1 / result);
+            if (lhs.isInt && fabsf(result) <= INT_NUMBER_LIMIT) return Number::fromInt((int) result);
+
+            return Number(result);
+        }
+    }
+
+    return Number(powf(lhs.num, (float) exponent));
 }
 
-BaseType *OpPower::eval(Number &lhs, Complex &rhs) {
+Value OpPower::eval(Number &lhs, Complex &rhs) {
     // a^(b + ci) = a^b(cos(c*ln(a)) + isin(c*ln(a)))
     float clna = rhs.imag * logf(lhs.num);
     float apowb = powf(lhs.num, rhs.real);
 
-    return new Complex(apowb * cosfMode(clna), apowb * sinfMode(clna));
+    return Complex(apowb * cosf(clna), apowb * sinf(clna));
 }
 
-BaseType *OpPower::eval(__attribute__((unused)) Number &lhs, __attribute__((unused)) Matrix &rhs) {
+Value OpPower::eval(__attribute__((unused)) Number &lhs, __attribute__((unused)) Matrix &rhs) {
     typeError();
 }
 
-BaseType *OpPower::eval(Complex &lhs, Number &rhs) {
-    // a + bi = r * (cos(theta) + isin(theta)), r=sqrt(a² + b²), tan(theta) = b / a
+Value OpPower::eval(Complex &lhs, Number &rhs) {
+    int exponent;
+
+    if (integerExponent(rhs, exponent)) {
+        if (exponent == 0) return Complex(1, 0);
+        if (exponent > 0) return powerBySquaring(lhs, exponent);
+
+        // 1 / (a + bi) = (a - bi) / (a² + b²)
+        Complex power = powerBySquaring(lhs, -exponent);
+        float denom = power.real * power.real + power.imag * power.imag;
+
+        if (denom == 0) divideBy0Error();
+
+        return Complex(power.real / denom, power.imag / -denom);
+    }
+
+    // a + bi = r * (cos(theta) + isin(theta)), r=sqrt(a² + b²), theta = atan2(b, a)
     // (a + bi) ^ N = r ^ N * (cos(Ntheta) + isin(Ntheta))
     float r = sqrtf(lhs.real * lhs.real + lhs.imag * lhs.imag);
 
-    float theta;
-    if (lhs.real == 0) {
-        theta = M_PI_2;
-    } else {
-        theta = atanfMode(lhs.imag / lhs.real);
-    }
+    // The angles are always in radians here, whatever the angle mode is
+    float theta = atan2f(lhs.imag, lhs.real);
 
     float Ntheta = rhs.num * theta;
     float rpowN = powf(r, rhs.num);
 
-    return new Complex(rpowN * cosfMode(Ntheta), rpowN * sinfMode(Ntheta));
+    return Complex(rpowN * cosf(Ntheta), rpowN * sinf(Ntheta));
 }
 
-BaseType *OpPower::eval(Complex &lhs, Complex &rhs) {
+Value OpPower::eval(Complex &lhs, Complex &rhs) {
     // (a + bi) ^ (c + di) =
     //      r = sqrt(a² + b²)
-    //      tan(theta) = b / a
+    //      theta = atan2(b, a)
     // exp((cln(r)-dtheta)+i(dln(r)+ctheta))
     float lnr = logf(sqrtf(lhs.real * lhs.real + lhs.imag * lhs.imag));
 
-    float theta;
-    if (lhs.real == 0) {
-        theta = M_PI_2;
-    } else {
-        theta = atanfMode(lhs.imag / lhs.real);
-    }
+    // The angles are always in radians here, whatever the angle mode is
+    float theta = atan2f(lhs.imag, lhs.real);
 
     float inner = rhs.imag * lnr + rhs.real * theta;
     float multiply = expf(rhs.real * lnr - rhs.imag * theta);
 
-    return new Complex(multiply * cosfMode(inner), multiply * sinfMode(inner));
+    return Complex(multiply * cosf(inner), multiply * sinf(inner));
 }
 
-BaseType *OpPower::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Number &rhs) {
-    // todo: matrix ^ N
-    typeError();
+Value OpPower::eval(Matrix &lhs, Number &rhs) {
+    int exponent;
+
+    if (!integerExponent(rhs, exponent) || exponent < 0 || exponent > MAX_MATRIX_POWER) domainError();
+
+    return matrixPower(lhs, exponent);
 }
 
-BaseType *OpFact::eval(Number &rhs) {
+Value OpFact::eval(Number &rhs) {
     float num = rhs.num;
 
     // 0! = 1
     if (num == 0) {
-        return new Number(1);
+        return Number(1);
     } else if (num == -0.5) {
-        return new Number(1.772453850905516);
+        return Number(1.772453850905516);
     }
     if (num < 0) domainError();
 
@@ -335,144 +691,226 @@ BaseType *OpFact::eval(Number &rhs) {
         result *= num;
     }
 
-    return new Number(result);
+    return Number(result);
 }
 
-BaseType *OpChs::eval(Number &rhs) {
-    return new Number(-rhs.num);
+Value OpChs::eval(Number &rhs) {
+    if (rhs.isInt) return Number::fromInt(-rhs.intNum);
+
+    return Number(-rhs.num);
 }
 
-BaseType *OpChs::eval(Complex &rhs) {
-    return new Complex(-rhs.real, -rhs.imag);
+Value OpChs::eval(Complex &rhs) {
+    return Complex(-rhs.real, -rhs.imag);
 }
 
-BaseType *OpChs::eval(Matrix &rhs) {
-    if (rhs.elements.empty()) dimensionError();
+Value OpChs::eval(List &rhs) {
+    if (!rhs.length) dimensionError();
 
-    auto newElements = rhs.elements;
+    List *result = List::createResult(rhs);
 
-    for (auto &row : newElements) {
-        for (auto &col : row) {
-            col = dynamic_cast<Number &>(*this->eval(col));
-        }
+    for (unsigned int i = 0; i < rhs.length; i++) {
+        result->elements[i] = -rhs.elements[i];
     }
 
-    return new Matrix(newElements);
+    return result;
 }
 
-BaseType *OpMul::eval(Number &lhs, Number &rhs) {
-    return new Number(lhs.num * rhs.num);
+Value OpChs::eval(Matrix &rhs) {
+    if (!rhs.size()) dimensionError();
+
+    Matrix *result = Matrix::createResult(rhs);
+
+    for (unsigned int i = 0; i < rhs.size(); i++) {
+        result->elements[i] = -rhs.elements[i];
+    }
+
+    return result;
+}
+
+Value OpMul::eval(Number &lhs, Number &rhs) {
+    return realMul(lhs, rhs);
 }
 
-BaseType *OpMul::eval(Number &lhs, Complex &rhs) {
-    return new Complex(lhs.num * rhs.real, lhs.num * rhs.imag);
+Value OpMul::eval(Number &lhs, Complex &rhs) {
+    return Complex(lhs.num * rhs.real, lhs.num * rhs.imag);
 }
 
-BaseType *OpMul::eval(Complex &lhs, Number &rhs) {
-    return new Complex(lhs.real * rhs.num, lhs.imag * rhs.num);
+Value OpMul::eval(Complex &lhs, Number &rhs) {
+    return Complex(lhs.real * rhs.num, lhs.imag * rhs.num);
 }
 
-BaseType *OpMul::eval(Complex &lhs, Complex &rhs) {
+Value OpMul::eval(Complex &lhs, Complex &rhs) {
     // (a + bi) * (c + di) = (ac - bd) + (ad + bc)i
-    return new Complex(lhs.real * rhs.real - lhs.imag * rhs.imag, lhs.real * rhs.imag + lhs.imag * rhs.real);
+    return Complex(lhs.real * rhs.real - lhs.imag * rhs.imag, lhs.real * rhs.imag + lhs.imag * rhs.real);
+}
+
+Value OpMul::eval(Number &lhs, List &rhs) {
+    if (!rhs.length) dimensionError();
+
+    List *result = List::createResult(rhs);
+
+    for (unsigned int i = 0; i < rhs.length; i++) {
+        result->elements[i] = lhs.num * rhs.elements[i];
+    }
+
+    return result;
 }
 
-BaseType *OpMul::eval(Matrix &lhs, Matrix &rhs) {
+Value OpMul::eval(List &lhs, Number &rhs) {
+    if (!lhs.length) dimensionError();
+
+    List *result = List::createResult(lhs);
+
+    for (unsigned int i = 0; i < lhs.length; i++) {
+        result->elements[i] = lhs.elements[i] * rhs.num;
+    }
+
+    return result;
+}
+
+Value OpMul::eval(List &lhs, List &rhs) {
+    if (!lhs.length) dimensionError();
+    if (lhs.length != rhs.length) dimensionMismatch();
+
+    List *result = List::createResult(lhs, rhs);
+
+    for (unsigned int i = 0; i < lhs.length; i++) {
+        result->elements[i] = lhs.elements[i] * rhs.elements[i];
+    }
+
+    return result;
+}
+
+Value OpMul::eval(Matrix &lhs, Matrix &rhs) {
     return multiplyMatrices(lhs, rhs);
 }
 
-BaseType *OpDiv::eval(Number &lhs, Number &rhs) {
-    if (rhs.num == 0) divideBy0Error();
+Value OpSolve::eval(Matrix &lhs, Matrix &rhs) {
+    return solve(lhs, rhs);
+}
 
-    return new Number(lhs.num / rhs.num);
+Value OpDiv::eval(Number &lhs, Number &rhs) {
+    return realDiv(lhs, rhs);
 }
 
-BaseType *OpDiv::eval(Number &lhs, Complex &rhs) {
+Value OpDiv::eval(Number &lhs, Complex &rhs) {
     // a / (b + ci) = (ab - aci) / (b² + c²)
     float denom = rhs.real * rhs.real + rhs.imag * rhs.imag;
 
     if (denom == 0) divideBy0Error();
 
-    return new Complex(lhs.num * rhs.real / denom, -lhs.num * rhs.imag / denom);
+    return Complex(lhs.num * rhs.real / denom, -lhs.num * rhs.imag / denom);
 }
 
-BaseType *OpDiv::eval(__attribute__((unused)) Number &lhs, __attribute__((unused)) Matrix &rhs) {
+Value OpDiv::eval(__attribute__((unused)) Number &lhs, __attribute__((unused)) Matrix &rhs) {
     typeError();
 }
 
-BaseType *OpDiv::eval(Complex &lhs, Number &rhs) {
+Value OpDiv::eval(Complex &lhs, Number &rhs) {
     if (rhs.num == 0) divideBy0Error();
 
-    return new Complex(lhs.real / rhs.num, lhs.imag / rhs.num);
+    return Complex(lhs.real / rhs.num, lhs.imag / rhs.num);
 }
 
-BaseType *OpDiv::eval(Complex &lhs, Complex &rhs) {
+Value OpDiv::eval(Complex &lhs, Complex &rhs) {
     // (a + bi) / (c + di) = ((ac + bd) + (bc - ad)i) / (c² + d²)
     float denom = rhs.real * rhs.real + rhs.imag * rhs.imag;
 
     if (denom == 0) divideBy0Error();
 
-    return new Complex(
+    return Complex(
             (lhs.real * rhs.real + lhs.imag * rhs.imag) / denom,
             (lhs.imag * rhs.real - lhs.real * rhs.imag) / denom
             );
 }
 
-BaseType *OpDiv::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Number &rhs) {
+Value OpDiv::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Number &rhs) {
     typeError();
 }
 
-BaseType *OpAddSub::eval(__attribute__((unused)) Number &lhs, __attribute__((unused)) Matrix &rhs) {
+Value OpAddSub::eval(__attribute__((unused)) Number &lhs, __attribute__((unused)) Matrix &rhs) {
     typeError();
 }
 
-BaseType *OpAddSub::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Number &rhs) {
+Value OpAddSub::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Number &rhs) {
     typeError();
 }
 
-BaseType *OpAddSub::eval(Matrix &lhs, Matrix &rhs) {
-    if (lhs.elements.empty()) dimensionError();
-    if (lhs.elements.size() != rhs.elements.size()) dimensionMismatch();
-    if (lhs.elements[0].size() != rhs.elements[0].size()) dimensionMismatch();
-
-    auto newElements = lhs.elements;
+Value OpAddSub::eval(Matrix &lhs, Matrix &rhs) {
+    if (!lhs.size()) dimensionError();
+    if (lhs.rows != rhs.rows || lhs.cols != rhs.cols) dimensionMismatch();
 
-    unsigned int rowIndex = 0;
-    for (auto &row : newElements) {
-        unsigned int colIndex = 0;
+    Matrix *result = Matrix::createResult(lhs, rhs);
 
-        for (auto &col : row) {
-            col = dynamic_cast<Number &>(*this->eval(col, rhs.elements[rowIndex][colIndex]));
-            colIndex++;
-        }
+    for (unsigned int i = 0; i < lhs.size(); i++) {
+        Number lhsElement(lhs.elements[i]);
+        Number rhsElement(rhs.elements[i]);
 
-        rowIndex++;
+        result->elements[i] = this->eval(lhsElement, rhsElement).asNumber().num;
     }
 
-    return new Matrix(newElements);
+    return result;
 }
 
-BaseType *OpAdd::eval(Number &lhs, Number &rhs) {
-    return new Number(lhs.num + rhs.num);
+Value OpAdd::eval(Number &lhs, Number &rhs) {
+    return realAdd(lhs, rhs);
 }
 
-BaseType *OpAdd::eval(Number &lhs, Complex &rhs) {
-    return new Complex(lhs.num + rhs.real, rhs.imag);
+Value OpAdd::eval(Number &lhs, Complex &rhs) {
+    return Complex(lhs.num + rhs.real, rhs.imag);
+}
+
+Value OpAdd::eval(Complex &lhs, Number &rhs) {
+    return Complex(lhs.real + rhs.num, lhs.imag);
+}
+
+Value OpAdd::eval(Complex &lhs, Complex &rhs) {
+    return Complex(lhs.real + rhs.real, lhs.imag + rhs.imag);
+}
+
+Value OpAdd::eval(Number &lhs, List &rhs) {
+    if (!rhs.length) dimensionError();
+
+    List *result = List::createResult(rhs);
+
+    for (unsigned int i = 0; i < rhs.length; i++) {
+        result->elements[i] = lhs.num + rhs.elements[i];
+    }
+
+    return result;
 }
 
-BaseType *OpAdd::eval(Complex &lhs, Number &rhs) {
-    return new Complex(lhs.real + rhs.num, lhs.imag);
+Value OpAdd::eval(List &lhs, Number &rhs) {
+    if (!lhs.length) dimensionError();
+
+    List *result = List::createResult(lhs);
+
+    for (unsigned int i = 0; i < lhs.length; i++) {
+        result->elements[i] = lhs.elements[i] + rhs.num;
+    }
+
+    return result;
 }
 
-BaseType *OpAdd::eval(Complex &lhs, Complex &rhs) {
-    return new Complex(lhs.real + rhs.real, lhs.imag + rhs.imag);
+Value OpAdd::eval(List &lhs, List &rhs) {
+    if (!lhs.length) dimensionError();
+    if (lhs.length != rhs.length) dimensionMismatch();
+
+    List *result = List::createResult(lhs, rhs);
+
+    for (unsigned int i = 0; i < lhs.length; i++) {
+        result->elements[i] = lhs.elements[i] + rhs.elements[i];
+    }
+
+    return result;
 }
 
-BaseType *OpAdd::eval(String &lhs, String &rhs) {
+Value OpAdd::eval(String &lhs, String &rhs) {
     if (!lhs.length || !rhs.length) dimensionError();
 
     unsigned int newLength = lhs.length + rhs.length;
-    char *newString = new char[newLength];
+    char *newString = String::allocate(newLength);
 
     memcpy(newString, lhs.string, lhs.length);
     memcpy(newString + lhs.length, rhs.string, rhs.length);
@@ -480,185 +918,217 @@ BaseType *OpAdd::eval(String &lhs, String &rhs) {
     return new String(newLength, newString);
 }
 
-BaseType *OpSub::eval(Number &lhs, Number &rhs) {
-    return new Number(lhs.num - rhs.num);
+Value OpSub::eval(Number &lhs, Number &rhs) {
+    return realSub(lhs, rhs);
 }
 
-BaseType *OpSub::eval(Number &lhs, Complex &rhs) {
-    return new Complex(lhs.num - rhs.real, -rhs.imag);
+Value OpSub::eval(Number &lhs, Complex &rhs) {
+    return Complex(lhs.num - rhs.real, -rhs.imag);
 }
 
-BaseType *OpSub::eval(Complex &lhs, Number &rhs) {
-    return new Complex(lhs.real - rhs.num, lhs.imag);
+Value OpSub::eval(Complex &lhs, Number &rhs) {
+    return Complex(lhs.real - rhs.num, lhs.imag);
 }
 
-BaseType *OpSub::eval(Complex &lhs, Complex &rhs) {
-    return new Complex(lhs.real - rhs.real, lhs.imag - rhs.imag);
+Value OpSub::eval(Complex &lhs, Complex &rhs) {
+    return Complex(lhs.real - rhs.real, lhs.imag - rhs.imag);
 }
 
-BaseType *OpSub::eval(__attribute__((unused)) String &lhs, __attribute__((unused)) String &rhs) {
+Value OpSub::eval(Number &lhs, List &rhs) {
+    if (!rhs.length) dimensionError();
+
+    List *result = List::createResult(rhs);
+
+    for (unsigned int i = 0; i < rhs.length; i++) {
+        result->elements[i] = lhs.num - rhs.elements[i];
+    }
+
+    return result;
+}
+
+Value OpSub::eval(List &lhs, Number &rhs) {
+    if (!lhs.length) dimensionError();
+
+    List *result = List::createResult(lhs);
+
+    for (unsigned int i = 0; i < lhs.length; i++) {
+        result->elements[i] = lhs.elements[i] - rhs.num;
+    }
+
+    return result;
+}
+
+Value OpSub::eval(List &lhs, List &rhs) {
+    if (!lhs.length) dimensionError();
+    if (lhs.length != rhs.length) dimensionMismatch();
+
+    List *result = List::createResult(lhs, rhs);
+
+    for (unsigned int i = 0; i < lhs.length; i++) {
+        result->elements[i] = lhs.elements[i] - rhs.elements[i];
+    }
+
+    return result;
+}
+
+Value OpSub::eval(__attribute__((unused)) String &lhs, __attribute__((unused)) String &rhs) {
     typeError();
 }
 
-BaseType *OpEquality::eval(__attribute__((unused)) Number &lhs, __attribute__((unused)) Complex &rhs) {
+Value OpEquality::eval(__attribute__((unused)) Number &lhs, __attribute__((unused)) Complex &rhs) {
     typeError();
 }
 
-BaseType *OpEquality::eval(__attribute__((unused)) Number &lhs, __attribute__((unused)) Matrix &rhs) {
+Value OpEquality::eval(__attribute__((unused)) Number &lhs, __attribute__((unused)) Matrix &rhs) {
     typeError();
 }
 
-BaseType *OpEquality::eval(__attribute__((unused)) Complex &lhs, __attribute__((unused)) Number &rhs) {
+Value OpEquality::eval(__attribute__((unused)) Complex &lhs, __attribute__((unused)) Number &rhs) {
     typeError();
 }
 
-BaseType *OpEquality::eval(Complex &lhs, ComplexList &rhs) {
-    if (rhs.elements.empty()) dimensionError();
+Value OpEquality::eval(Complex &lhs, ComplexList &rhs) {
+    if (!rhs.length) dimensionError();
+
+    List *result = List::create(rhs.length);
 
-    auto newElements = vector<Number>(rhs.elements.size());
+    for (unsigned int i = 0; i < rhs.length; i++) {
+        Complex element = rhs.at(i);
 
-    unsigned int index = 0;
-    for (auto &cplx : rhs.elements) {
-        newElements[index++] = dynamic_cast<Number &>(*this->eval(lhs, cplx));
+        result->elements[i] = this->eval(lhs, element).asNumber().num;
     }
 
-    return new List(newElements);
+    return result;
 }
 
-BaseType *OpEquality::eval(ComplexList &lhs, Complex &rhs) {
-    if (lhs.elements.empty()) dimensionError();
+Value OpEquality::eval(ComplexList &lhs, Complex &rhs) {
+    if (!lhs.length) dimensionError();
 
-    auto newElements = vector<Number>(lhs.elements.size());
+    List *result = List::create(lhs.length);
 
-    unsigned int index = 0;
-    for (auto &cplx : lhs.elements) {
-        newElements[index++] = dynamic_cast<Number &>(*this->eval(cplx, rhs));
+    for (unsigned int i = 0; i < lhs.length; i++) {
+        Complex element = lhs.at(i);
+
+        result->elements[i] = this->eval(element, rhs).asNumber().num;
     }
 
-    return new List(newElements);
+    return result;
 }
 
-BaseType *OpEquality::eval(ComplexList &lhs, ComplexList &rhs) {
-    if (lhs.elements.empty()) dimensionError();
-    if (rhs.elements.size() != rhs.elements.size()) dimensionMismatch();
+Value OpEquality::eval(ComplexList &lhs, ComplexList &rhs) {
+    if (!lhs.length) dimensionError();
+    if (lhs.length != rhs.length) dimensionMismatch();
 
-    auto newElements = vector<Number>(lhs.elements.size());
+    List *result = List::create(lhs.length);
 
-    unsigned int index = 0;
-    for (auto &cplx : lhs.elements) {
-        newElements[index] = dynamic_cast<Number &>(*this->eval(cplx, rhs.elements[index]));
-        index++;
+    for (unsigned int i = 0; i < lhs.length; i++) {
+        Complex lhsElement = lhs.at(i);
+        Complex rhsElement = rhs.at(i);
+
+        result->elements[i] = this->eval(lhsElement, rhsElement).asNumber().num;
     }
 
-    return new List(newElements);
+    return result;
 }
 
-BaseType *OpEquality::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Number &rhs) {
+Value OpEquality::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Number &rhs) {
     typeError();
 }
 
-BaseType *OpEquality::eval(Matrix &lhs, Matrix &rhs) {
-    if (lhs.elements.empty()) dimensionError();
-    if (lhs.elements.size() != rhs.elements.size()) dimensionMismatch();
-    if (lhs.elements[0].size() != rhs.elements[0].size()) dimensionMismatch();
+Value OpEquality::eval(Matrix &lhs, Matrix &rhs) {
+    if (!lhs.size()) dimensionError();
+    if (lhs.rows != rhs.rows || lhs.cols != rhs.cols) dimensionMismatch();
 
-    unsigned int rowIndex = 0;
-    for (auto &row : lhs.elements) {
-        unsigned int colIndex = 0;
-        for (auto &col : row) {
-            auto result = dynamic_cast<Number &>(*this->eval(col, rhs.elements[rowIndex][colIndex]));
-
-            if (result.num == 0) return new Number(0);
-
-            colIndex++;
-        }
+    for (unsigned int i = 0; i < lhs.size(); i++) {
+        Number lhsElement(lhs.elements[i]);
+        Number rhsElement(rhs.elements[i]);
 
-        rowIndex++;
+        if (this->eval(lhsElement, rhsElement).asNumber().num == 0) return Number(0);
     }
 
-    return new Number(1);
+    return Number(1);
 }
 
-BaseType *OpEQ::eval(Number &lhs, Number &rhs) {
-    return new Number(lhs.num == rhs.num);
+Value OpEQ::eval(Number &lhs, Number &rhs) {
+    return realEQ(lhs, rhs);
 }
 
-BaseType *OpEQ::eval(Complex &lhs, Complex &rhs) {
-    return new Number(lhs.real == rhs.real && lhs.imag == rhs.imag);
+Value OpEQ::eval(Complex &lhs, Complex &rhs) {
+    return Number::fromBool(lhs.real == rhs.real && lhs.imag == rhs.imag);
 }
 
-BaseType *OpLT::eval(Number &lhs, Number &rhs) {
-    return new Number(lhs.num < rhs.num);
+Value OpLT::eval(Number &lhs, Number &rhs) {
+    return realLT(lhs, rhs);
 }
 
-BaseType *OpLT::eval(__attribute__((unused)) Complex &lhs, __attribute__((unused)) Complex &rhs) {
+Value OpLT::eval(__attribute__((unused)) Complex &lhs, __attribute__((unused)) Complex &rhs) {
     typeError();
 }
 
-BaseType *OpLT::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Matrix &rhs) {
+Value OpLT::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Matrix &rhs) {
     typeError();
 }
 
-BaseType *OpGT::eval(Number &lhs, Number &rhs) {
-    return new Number(lhs.num > rhs.num);
+Value OpGT::eval(Number &lhs, Number &rhs) {
+    return realGT(lhs, rhs);
 }
 
-BaseType *OpGT::eval(__attribute__((unused)) Complex &lhs, __attribute__((unused)) Complex &rhs) {
+Value OpGT::eval(__attribute__((unused)) Complex &lhs, __attribute__((unused)) Complex &rhs) {
     typeError();
 }
 
-BaseType *OpGT::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Matrix &rhs) {
+Value OpGT::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Matrix &rhs) {
     typeError();
 }
 
-BaseType *OpLE::eval(Number &lhs, Number &rhs) {
-    return new Number(lhs.num < rhs.num);
+Value OpLE::eval(Number &lhs, Number &rhs) {
+    return realLE(lhs, rhs);
 }
 
-BaseType *OpLE::eval(__attribute__((unused)) Complex &lhs, __attribute__((unused)) Complex &rhs) {
+Value OpLE::eval(__attribute__((unused)) Complex &lhs, __attribute__((unused)) Complex &rhs) {
     typeError();
 }
 
-BaseType *OpLE::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Matrix &rhs) {
+Value OpLE::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Matrix &rhs) {
     typeError();
 }
 
-BaseType *OpGE::eval(Number &lhs, Number &rhs) {
-    return new Number(lhs.num > rhs.num);
+Value OpGE::eval(Number &lhs, Number &rhs) {
+    return realGE(lhs, rhs);
 }
 
-BaseType *OpGE::eval(__attribute__((unused)) Complex &lhs, __attribute__((unused)) Complex &rhs) {
+Value OpGE::eval(__attribute__((unused)) Complex &lhs, __attribute__((unused)) Complex &rhs) {
     typeError();
 }
 
-BaseType *OpGE::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Matrix &rhs) {
+Value OpGE::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Matrix &rhs) {
     typeError();
 }
 
-BaseType *OpNE::eval(Number &lhs, Number &rhs) {
-    return new Number(lhs.num != rhs.num);
+Value OpNE::eval(Number &lhs, Number &rhs) {
+    return realNE(lhs, rhs);
 }
 
-BaseType *OpNE::eval(Complex &lhs, Complex &rhs) {
-    return new Number(lhs.real != rhs.real || lhs.imag != rhs.imag);
+Value OpNE::eval(Complex &lhs, Complex &rhs) {
+    return Number::fromBool(lhs.real != rhs.real || lhs.imag != rhs.imag);
 }
 
-BaseType *OpLogically::eval(__attribute__((unused)) Complex &lhs, __attribute__((unused)) Complex &rhs) {
+Value OpLogically::eval(__attribute__((unused)) Complex &lhs, __attribute__((unused)) Complex &rhs) {
     typeError();
 }
 
-BaseType *OpLogically::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Matrix &rhs) {
+Value OpLogically::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Matrix &rhs) {
     typeError();
 }
 
-BaseType *OpAnd::eval(Number &lhs, Number &rhs) {
-    return new Number(lhs.num != 0 && rhs.num != 0);
+Value OpAnd::eval(Number &lhs, Number &rhs) {
+    return Number::fromBool(lhs.num != 0 && rhs.num != 0);
 }
 
-BaseType *OpOr::eval(Number &lhs, Number &rhs) {
-    return new Number(lhs.num != 0 || rhs.num != 0);
+Value OpOr::eval(Number &lhs, Number &rhs) {
+    return Number::fromBool(lhs.num != 0 || rhs.num != 0);
 }
 
-BaseType *OpXor::eval(Number &lhs, Number &rhs) {
-    return new Number((lhs.num != 0) != (rhs.num != 0));
+Value OpXor::eval(Number &lhs, Number &rhs) {
+    return Number::fromBool((lhs.num != 0) != (rhs.num != 0));
 }
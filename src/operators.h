@@ -8,225 +8,284 @@
 #define MAX_PRECEDENCE 11
 
 class OpFromRad : public UnaryOperator {
-    BaseType *eval(Number &rhs) override;
+    Value eval(Number &rhs) override;
 };
 
 class OpFromDeg : public UnaryOperator {
-    BaseType *eval(Number &rhs) override;
+    Value eval(Number &rhs) override;
 };
 
 class OpRecip : public UnaryOperator {
-    BaseType *eval(Number &rhs) override;
+    Value eval(Number &rhs) override;
 
-    BaseType *eval(Complex &rhs) override;
+    Value eval(Complex &rhs) override;
 
-    BaseType *eval(Matrix &rhs) override;
+    Value eval(Matrix &rhs) override;
 };
 
 class OpSqr : public UnaryOperator {
-    BaseType *eval(Number &rhs) override;
+    Value eval(Number &rhs) override;
 
-    BaseType *eval(Complex &rhs) override;
+    Value eval(Complex &rhs) override;
 
-    BaseType *eval(Matrix &rhs) override;
+    Value eval(Matrix &rhs) override;
 };
 
 class OpTrnspos : public UnaryOperator {
-    BaseType *eval(Matrix &rhs) override;
+    Value eval(Matrix &rhs) override;
 };
 
 class OpCube : public UnaryOperator {
-    BaseType *eval(Number &rhs) override;
+    Value eval(Number &rhs) override;
 
-    BaseType *eval(Complex &rhs) override;
+    Value eval(Complex &rhs) override;
 
-    BaseType *eval(Matrix &rhs) override;
+    Value eval(Matrix &rhs) override;
 };
 
 class OpPower : public BinaryOperator {
-    BaseType *eval(Number &lhs, Number &rhs) override;
+    Value eval(Number &lhs, Number &rhs) override;
 
-    BaseType *eval(Number &lhs, Complex &rhs) override;
+    Value eval(Number &lhs, Complex &rhs) override;
 
-    BaseType *eval(Number &lhs, Matrix &rhs) override;
+    Value eval(Number &lhs, Matrix &rhs) override;
 
-    BaseType *eval(Complex &lhs, Number &rhs) override;
+    Value eval(Complex &lhs, Number &rhs) override;
 
-    BaseType *eval(Complex &lhs, Complex &rhs) override;
+    Value eval(Complex &lhs, Complex &rhs) override;
 
-    BaseType *eval(Matrix &lhs, Number &rhs) override;
+    Value eval(Matrix &lhs, Number &rhs) override;
 };
 
 class OpFact : public UnaryOperator {
-    BaseType *eval(Number &rhs) override;
+    Value eval(Number &rhs) override;
 };
 
 class OpChs : public UnaryOperator {
-    BaseType *eval(Number &rhs) override;
+    Value eval(Number &rhs) override;
 
-    BaseType *eval(Complex &rhs) override;
+    Value eval(Complex &rhs) override;
 
-    BaseType *eval(Matrix &rhs) override;
+    Value eval(List &rhs) override;
+
+    Value eval(Matrix &rhs) override;
 };
 
 class OpMul : public BinaryOperator {
-    BaseType *eval(Number &lhs, Number &rhs) override;
+    Value eval(Number &lhs, Number &rhs) override;
+
+    Value eval(Number &lhs, Complex &rhs) override;
+
+    Value eval(Complex &lhs, Number &rhs) override;
+
+    Value eval(Complex &lhs, Complex &rhs) override;
 
-    BaseType *eval(Number &lhs, Complex &rhs) override;
+    Value eval(Number &lhs, List &rhs) override;
 
-    BaseType *eval(Complex &lhs, Number &rhs) override;
+    Value eval(List &lhs, Number &rhs) override;
 
-    BaseType *eval(Complex &lhs, Complex &rhs) override;
+    Value eval(List &lhs, List &rhs) override;
 
-    BaseType *eval(Matrix &lhs, Matrix &rhs) override;
+    Value eval(Matrix &lhs, Matrix &rhs) override;
+};
+
+// Solves lhs * X = rhs, the optimized form of lhs⁻¹ * rhs
+class OpSolve : public BinaryOperator {
+    Value eval(Matrix &lhs, Matrix &rhs) override;
 };
 
 class OpDiv : public BinaryOperator {
-    BaseType *eval(Number &lhs, Number &rhs) override;
+    Value eval(Number &lhs, Number &rhs) override;
 
-    BaseType *eval(Number &lhs, Complex &rhs) override;
+    Value eval(Number &lhs, Complex &rhs) override;
 
-    BaseType *eval(Number &lhs, Matrix &rhs) override;
+    Value eval(Number &lhs, Matrix &rhs) override;
 
-    BaseType *eval(Complex &lhs, Number &rhs) override;
+    Value eval(Complex &lhs, Number &rhs) override;
 
-    BaseType *eval(Complex &lhs, Complex &rhs) override;
+    Value eval(Complex &lhs, Complex &rhs) override;
 
-    BaseType *eval(Matrix &lhs, Number &rhs) override;
+    Value eval(Matrix &lhs, Number &rhs) override;
 };
 
 class OpAddSub : public BinaryOperator {
-    BaseType *eval(Number &lhs, Number &rhs) override = 0;
+    Value eval(Number &lhs, Number &rhs) override = 0;
 
-    BaseType *eval(Number &lhs, Complex &rhs) override = 0;
+    Value eval(Number &lhs, Complex &rhs) override = 0;
 
-    BaseType *eval(Number &lhs, Matrix &rhs) override;
+    Value eval(Number &lhs, Matrix &rhs) override;
 
-    BaseType *eval(Complex &lhs, Number &rhs) override = 0;
+    Value eval(Complex &lhs, Number &rhs) override = 0;
 
-    BaseType *eval(Complex &lhs, Complex &rhs) override = 0;
+    Value eval(Complex &lhs, Complex &rhs) override = 0;
 
-    BaseType *eval(String &lhs, String &rhs) override = 0;
+    Value eval(String &lhs, String &rhs) override = 0;
 
-    BaseType *eval(Matrix &lhs, Number &rhs) override;
+    Value eval(Matrix &lhs, Number &rhs) override;
 
-    BaseType *eval(Matrix &lhs, Matrix &rhs) override;
+    Value eval(Matrix &lhs, Matrix &rhs) override;
 };
 
 class OpAdd : public OpAddSub {
-    BaseType *eval(Number &lhs, Number &rhs) override;
+    Value eval(Number &lhs, Number &rhs) override;
+
+    Value eval(Number &lhs, Complex &rhs) override;
+
+    Value eval(Complex &lhs, Number &rhs) override;
 
-    BaseType *eval(Number &lhs, Complex &rhs) override;
+    Value eval(Complex &lhs, Complex &rhs) override;
 
-    BaseType *eval(Complex &lhs, Number &rhs) override;
+    Value eval(Number &lhs, List &rhs) override;
 
-    BaseType *eval(Complex &lhs, Complex &rhs) override;
+    Value eval(List &lhs, Number &rhs) override;
 
-    BaseType *eval(String &lhs, String &rhs) override;
+    Value eval(List &lhs, List &rhs) override;
+
+    Value eval(String &lhs, String &rhs) override;
 };
 
 class OpSub : public OpAddSub {
-    BaseType *eval(Number &lhs, Number &rhs) override;
+    Value eval(Number &lhs, Number &rhs) override;
+
+    Value eval(Number &lhs, Complex &rhs) override;
+
+    Value eval(Complex &lhs, Number &rhs) override;
+
+    Value eval(Complex &lhs, Complex &rhs) override;
 
-    BaseType *eval(Number &lhs, Complex &rhs) override;
+    Value eval(Number &lhs, List &rhs) override;
 
-    BaseType *eval(Complex &lhs, Number &rhs) override;
+    Value eval(List &lhs, Number &rhs) override;
 
-    BaseType *eval(Complex &lhs, Complex &rhs) override;
+    Value eval(List &lhs, List &rhs) override;
 
-    BaseType *eval(String &lhs, String &rhs) override;
+    Value eval(String &lhs, String &rhs) override;
 };
 
 class OpEquality : public BinaryOperator {
-    BaseType *eval(Number &lhs, Number &rhs) override = 0;
+    Value eval(Number &lhs, Number &rhs) override = 0;
 
-    BaseType *eval(Number &lhs, Complex &rhs) override;
+    Value eval(Number &lhs, Complex &rhs) override;
 
-    BaseType *eval(Number &lhs, Matrix &rhs) override;
+    Value eval(Number &lhs, Matrix &rhs) override;
 
-    BaseType *eval(Complex &lhs, Number &rhs) override;
+    Value eval(Complex &lhs, Number &rhs) override;
 
-    BaseType *eval(Complex &lhs, Complex &rhs) override = 0;
+    Value eval(Complex &lhs, Complex &rhs) override = 0;
 
-    BaseType *eval(Complex &lhs, ComplexList &rhs) override;
+    Value eval(Complex &lhs, ComplexList &rhs) override;
 
-    BaseType *eval(ComplexList &lhs, Complex &rhs) override;
+    Value eval(ComplexList &lhs, Complex &rhs) override;
 
-    BaseType *eval(ComplexList &lhs, ComplexList &rhs) override;
+    Value eval(ComplexList &lhs, ComplexList &rhs) override;
 
-    BaseType *eval(Matrix &lhs, Number &rhs) override;
+    Value eval(Matrix &lhs, Number &rhs) override;
 
-    BaseType *eval(Matrix &lhs, Matrix &rhs) override;
+    Value eval(Matrix &lhs, Matrix &rhs) override;
 };
 
 class OpEQ : public OpEquality {
-    BaseType * eval(Number &lhs, Number &rhs) override;
+    Value eval(Number &lhs, Number &rhs) override;
 
-    BaseType * eval(Complex &lhs, Complex &rhs) override;
+    Value eval(Complex &lhs, Complex &rhs) override;
 };
 
 class OpLT : public OpEquality {
-    BaseType * eval(Number &lhs, Number &rhs) override;
+    Value eval(Number &lhs, Number &rhs) override;
 
-    BaseType * eval(Complex &lhs, Complex &rhs) override;
+    Value eval(Complex &lhs, Complex &rhs) override;
 
-    BaseType *eval(Matrix &lhs, Matrix &rhs) override;
+    Value eval(Matrix &lhs, Matrix &rhs) override;
 };
 
 class OpGT : public OpEquality {
-    BaseType * eval(Number &lhs, Number &rhs) override;
+    Value eval(Number &lhs, Number &rhs) override;
 
-    BaseType * eval(Complex &lhs, Complex &rhs) override;
+    Value eval(Complex &lhs, Complex &rhs) override;
 
-    BaseType *eval(Matrix &lhs, Matrix &rhs) override;
+    Value eval(Matrix &lhs, Matrix &rhs) override;
 };
 
 class OpLE : public OpEquality {
-    BaseType * eval(Number &lhs, Number &rhs) override;
+    Value eval(Number &lhs, Number &rhs) override;
 
-    BaseType * eval(Complex &lhs, Complex &rhs) override;
+    Value eval(Complex &lhs, Complex &rhs) override;
 
-    BaseType *eval(Matrix &lhs, Matrix &rhs) override;
+    Value eval(Matrix &lhs, Matrix &rhs) override;
 };
 
 class OpGE : public OpEquality {
-    BaseType * eval(Number &lhs, Number &rhs) override;
+    Value eval(Number &lhs, Number &rhs) override;
 
-    BaseType * eval(Complex &lhs, Complex &rhs) override;
+    Value eval(Complex &lhs, Complex &rhs) override;
 
-    BaseType *eval(Matrix &lhs, Matrix &rhs) override;
+    Value eval(Matrix &lhs, Matrix &rhs) override;
 };
 
 class OpNE : public OpEquality {
-    BaseType * eval(Number &lhs, Number &rhs) override;
+    Value eval(Number &lhs, Number &rhs) override;
 
-    BaseType * eval(Complex &lhs, Complex &rhs) override;
+    Value eval(Complex &lhs, Complex &rhs) override;
 };
 
 class OpLogically : public OpEquality {
-    BaseType * eval(Number &lhs, Number &rhs) override = 0;
+    Value eval(Number &lhs, Number &rhs) override = 0;
 
-    BaseType * eval(Complex &lhs, Complex &rhs) override;
+    Value eval(Complex &lhs, Complex &rhs) override;
 
-    BaseType * eval(Matrix &lhs, Matrix &rhs) override;
+    Value eval(Matrix &lhs, Matrix &rhs) override;
 };
 
 class OpAnd : public OpLogically {
-    BaseType * eval(Number &lhs, Number &rhs) override;
+    Value eval(Number &lhs, Number &rhs) override;
 };
 
 class OpOr : public OpLogically {
-    BaseType * eval(Number &lhs, Number &rhs) override;
+    Value eval(Number &lhs, Number &rhs) override;
 };
 
 class OpXor : public OpLogically {
-    BaseType * eval(Number &lhs, Number &rhs) override;
+    Value eval(Number &lhs, Number &rhs) override;
 };
 
 uint8_t getOpPrecedence(uint8_t op);
 
 bool isUnaryOp(uint8_t prec);
 
-BaseType *evalOperator(struct NODE *op_node);
+UnaryOperator *getUnaryOperator(uint8_t op);
+
+BinaryOperator *getBinaryOperator(uint8_t op);
+
+BinaryOperator *getSolveOperator();
+
+Value evalUnaryOperator(UnaryOperator *op, Value &rhs);
+
+Number realAdd(const Number &lhs, const Number &rhs);
+
+Number realSub(const Number &lhs, const Number &rhs);
+
+Number realMul(const Number &lhs, const Number &rhs);
+
+Number realDiv(const Number &lhs, const Number &rhs);
+
+Number realEQ(const Number &lhs, const Number &rhs);
+
+Number realNE(const Number &lhs, const Number &rhs);
+
+Number realLT(const Number &lhs, const Number &rhs);
+
+Number realGT(const Number &lhs, const Number &rhs);
+
+Number realLE(const Number &lhs, const Number &rhs);
+
+Number realGE(const Number &lhs, const Number &rhs);
+
+Number evalRealOperator(uint8_t op, const Number &lhs, const Number &rhs);
+
+Value evalBinaryOperator(BinaryOperator *op, Value &lhs, Value &rhs);
+
+Value evalOperator(struct NODE *op_node);
+
+Value evalFused(const struct fused_expr *fused, Value *leaves);
 
 #endif
@@ -0,0 +1,577 @@
+#include "optimize.h"
+#include "ast.h"
+#include "evaluate.h"
+#include "globals.h"
+#include "operators.h"
+#include "stats.h"
+#include "variables.h"
+
+#include <cmath>
+#include <cstring>
+#include <ti/tokens.h>
+
+// Whether the angle mode can change while the program runs. If not, trigonometry can be folded with the current mode.
+static bool modeCanChange;
+
+static unsigned int foldedNodes;
+
+static bool isNumberLiteral(node_t index, float num) {
+    struct NODE *node = getNode(index);
+
+    return node->data.type == ET_NUMBER && node->data.operand.num == num;
+}
+
+/**
+ * Checks whether a node always evaluates to a real/complex number, list or matrix. Strings are excluded, as the
+ * identities below would hide the type error of "ABC"*1. Matrices are only included if allowMatrices is set, as
+ * [A]+0 and [A]/1 are type errors too; only [A]*1 and [A]^2 are valid.
+ */
+static bool isNumeric(node_t index, bool allowMatrices) {
+    struct NODE *node = getNode(index);
+
+    switch (node->data.type) {
+        case ET_NUMBER:
+        case ET_COMPLEX:
+        case ET_VARIABLE:
+        case ET_LIST:
+        case ET_CUSTOM_LIST:
+        case ET_LIST_ELEMENT:
+        case ET_MATRIX_ELEMENT:
+            return true;
+        case ET_MATRIX:
+            return allowMatrices;
+        case ET_OPERATOR:
+            if (node->data.operand.op.token == OS_TOK_STO) return false;
+
+            for (node_t child = node->child; child; child = getNode(child)->next) {
+                if (!isNumeric(child, allowMatrices)) return false;
+            }
+
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void freeSubtree(node_t index) {
+    node_t child = getNode(index)->child;
+
+    while (child) {
+        node_t next = getNode(child)->next;
+
+        freeSubtree(child);
+        child = next;
+    }
+
+    freeNode(index);
+    foldedNodes++;
+}
+
+/**
+ * Only operators which can't raise an error for these operands are folded, otherwise the error would be raised while
+ * parsing, even if the expression is never evaluated.
+ */
+static bool canFoldOperator(uint8_t op, float lhs, float rhs) {
+    switch (op) {
+        case OS_TOK_FROM_RAD:
+        case OS_TOK_FROM_DEG:
+            return !modeCanChange;
+        case OS_TOK_RECIPROCAL:
+            return lhs != 0;
+        case OS_TOK_EXCLAIM:
+            return lhs >= 0 && lhs <= 69 && lhs == (float) (int) lhs;
+        case OS_TOK_DIVIDE:
+            return rhs != 0;
+        case OS_TOK_POWER:
+            return lhs != 0 || rhs >= 0;
+        case OS_TOK_SQRT:
+        case OS_TOK_CUBE:
+        case OS_TOK_NEGATIVE:
+        case OS_TOK_MULTIPLY:
+        case OS_TOK_ADD:
+        case OS_TOK_SUBTRACT:
+        case OS_TOK_EQUAL:
+        case OS_TOK_LESS_THAN:
+        case OS_TOK_GREATER_THAN:
+        case OS_TOK_LESS_THAN_EQUAL:
+        case OS_TOK_GREATER_THAN_EQUAL:
+        case OS_TOK_NOT_EQUAL:
+        case OS_TOK_AND:
+        case OS_TOK_OR:
+        case OS_TOK_XOR:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool canFoldFunction(unsigned int func, float arg) {
+    switch (func) {
+        case OS_TOK_ROUND:
+            return true;
+        case OS_TOK_SIN:
+        case OS_TOK_COS:
+            return !modeCanChange;
+        case OS_TOK_TAN:
+            // The tangent of an odd multiple of 90 degrees is a domain error, which should only happen when it's run
+            return !modeCanChange && (globals.inRadianMode || fabsf(fmodf(arg, 180)) != 90);
+        default:
+            return false;
+    }
+}
+
+/**
+ * Replaces a node by a number, and frees all its children
+ */
+static void foldNode(node_t index) {
+    struct NODE *node = getNode(index);
+    Value result = evalNode(node);
+
+    // Complex literals can't have a real part, so only fold real results
+    if (result.type != TypeType::NUMBER) return;
+
+    node_t child = node->child;
+    while (child) {
+        node_t next = getNode(child)->next;
+
+        freeSubtree(child);
+        child = next;
+    }
+
+    node->data.type = ET_NUMBER;
+    node->data.operand.num = result.number.num;
+    node->child = 0;
+}
+
+/**
+ * Replaces a node by one of its children, like x*1 -> x, and frees the other child
+ */
+static void replaceByChild(node_t index, node_t keep, node_t drop) {
+    struct NODE *node = getNode(index);
+    struct NODE *keepNode = getNode(keep);
+
+    node->data = keepNode->data;
+    node->child = keepNode->child;
+
+    freeNode(keep);
+    foldedNodes++;
+    freeSubtree(drop);
+}
+
+static bool isMatrixInverse(node_t index) {
+    struct NODE *node = getNode(index);
+
+    return node->data.type == ET_OPERATOR && node->data.operand.op.token == OS_TOK_RECIPROCAL &&
+           getNode(node->child)->data.type == ET_MATRIX;
+}
+
+/**
+ * Replaces [A]⁻¹[B] by solving [A]X = [B], which is both faster and more accurate than multiplying by the inverse
+ */
+static void solveInsteadOfInvert(node_t index) {
+    struct NODE *node = getNode(index);
+    node_t inverse = node->child;
+    node_t matrix = getNode(inverse)->child;
+
+    getNode(matrix)->next = getNode(inverse)->next;
+    node->child = matrix;
+    node->data.operand.op.handler.binary = getSolveOperator();
+
+    freeNode(inverse);
+    foldedNodes++;
+}
+
+static void simplifyOperator(node_t index) {
+    struct NODE *node = getNode(index);
+    struct op_t &op = node->data.operand.op;
+    node_t lhs = node->child;
+
+    if (isUnaryOp(op.precedence)) {
+        if (getNode(lhs)->data.type == ET_NUMBER && op.handler.unary != nullptr &&
+            canFoldOperator(op.token, getNode(lhs)->data.operand.num, 0)) {
+            foldNode(index);
+        }
+
+        return;
+    }
+
+    node_t rhs = getNode(lhs)->next;
+
+    if (getNode(lhs)->data.type == ET_NUMBER && getNode(rhs)->data.type == ET_NUMBER) {
+        if (op.handler.binary != nullptr &&
+            canFoldOperator(op.token, getNode(lhs)->data.operand.num, getNode(rhs)->data.operand.num)) {
+            foldNode(index);
+        }
+
+        return;
+    }
+
+    if (!isNumeric(lhs, true) || !isNumeric(rhs, true)) return;
+
+    bool noMatrices = isNumeric(lhs, false) && isNumeric(rhs, false);
+
+    switch (op.token) {
+        case OS_TOK_MULTIPLY:
+            if (isNumberLiteral(rhs, 1)) replaceByChild(index, lhs, rhs);
+            else if (isNumberLiteral(lhs, 1)) replaceByChild(index, rhs, lhs);
+            else if (isMatrixInverse(lhs) && getNode(rhs)->data.type == ET_MATRIX) solveInsteadOfInvert(index);
+            break;
+        case OS_TOK_ADD:
+            if (!noMatrices) break;
+            if (isNumberLiteral(rhs, 0)) replaceByChild(index, lhs, rhs);
+            else if (isNumberLiteral(lhs, 0)) replaceByChild(index, rhs, lhs);
+            break;
+        case OS_TOK_SUBTRACT:
+            if (noMatrices && isNumberLiteral(rhs, 0)) replaceByChild(index, lhs, rhs);
+            break;
+        case OS_TOK_DIVIDE:
+            if (noMatrices && isNumberLiteral(rhs, 1)) replaceByChild(index, lhs, rhs);
+            break;
+        case OS_TOK_POWER:
+            // x^2 -> x², which evaluates x only once and multiplies it by itself
+            if (isNumberLiteral(rhs, 2)) {
+                getNode(lhs)->next = 0;
+                freeSubtree(rhs);
+
+                op.token = OS_TOK_SQRT;
+                op.precedence = getOpPrecedence(OS_TOK_SQRT);
+                op.handler.unary = getUnaryOperator(OS_TOK_SQRT);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void optimizeNode(node_t index) {
+    for (node_t child = getNode(index)->child; child; child = getNode(child)->next) {
+        optimizeNode(child);
+    }
+
+    struct NODE *node = getNode(index);
+
+    if (node->data.type == ET_OPERATOR) {
+        simplifyOperator(index);
+    } else if (node->data.type == ET_FUNCTION_CALL) {
+        const struct func_t &func = node->data.operand.func;
+
+        struct NODE *arg = getNode(node->child);
+
+        if (func.handler != nullptr && arg->data.type == ET_NUMBER && canFoldFunction(func.token, arg->data.operand.num)) {
+            foldNode(index);
+        }
+    }
+}
+
+static bool changesMode(node_t index) {
+    struct NODE *node = getNode(index);
+
+    if (node->data.type == ET_FUNCTION_CALL &&
+        (node->data.operand.func.token == OS_TOK_RADIAN || node->data.operand.func.token == OS_TOK_DEGREE)) {
+        return true;
+    }
+
+    for (node_t child = node->child; child; child = getNode(child)->next) {
+        if (changesMode(child)) return true;
+    }
+
+    return false;
+}
+
+// Whether a variable may hold a complex number at some point, A-Z and theta
+static bool complexVariables[27];
+
+static unsigned int realOperators;
+
+/**
+ * Checks whether a node certainly evaluates to a real number, given the variables which may become complex. Only
+ * operators and functions which always give a real number for real arguments count.
+ */
+static bool isReal(node_t index) {
+    struct NODE *node = getNode(index);
+
+    switch (node->data.type) {
+        case ET_NUMBER:
+        case ET_MATRIX_ELEMENT:     // Matrices can only hold real numbers
+            return true;
+        case ET_VARIABLE:
+            return !complexVariables[node->data.operand.variableNr];
+        case ET_OPERATOR:
+            switch (node->data.operand.op.token) {
+                case OS_TOK_STO:
+                    return isReal(node->child);
+                case OS_TOK_TRANSPOSE:
+                case OS_TOK_NPR:
+                case OS_TOK_NCR:
+                case OS_TOK_COMMA:
+                    return false;
+                default:
+                    break;
+            }
+
+            for (node_t child = node->child; child; child = getNode(child)->next) {
+                if (!isReal(child)) return false;
+            }
+
+            return true;
+        case ET_FUNCTION_CALL:
+            switch (node->data.operand.func.token) {
+                case OS_TOK_ROUND:
+                case OS_TOK_SIN:
+                case OS_TOK_COS:
+                case OS_TOK_TAN:
+                    return node->data.operand.func.handler != nullptr && isReal(node->child);
+                case OS_TOK_DET:
+                    return node->data.operand.func.handler != nullptr;
+                default:
+                    return false;
+            }
+        default:
+            return false;
+    }
+}
+
+/**
+ * Marks the variables which are stored a value that might not be real
+ * @return Whether a new variable was marked
+ */
+static bool markComplexStores(node_t index) {
+    struct NODE *node = getNode(index);
+    bool changed = false;
+
+    for (node_t child = node->child; child; child = getNode(child)->next) {
+        if (markComplexStores(child)) changed = true;
+    }
+
+    if (node->data.type == ET_OPERATOR && node->data.operand.op.token == OS_TOK_STO) {
+        struct NODE *var = getNode(getNode(node->child)->next);
+
+        if (var->data.type == ET_VARIABLE && !complexVariables[var->data.operand.variableNr] && !isReal(node->child)) {
+            complexVariables[var->data.operand.variableNr] = true;
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+static bool isRealOperator(uint8_t op) {
+    switch (op) {
+        case OS_TOK_ADD:
+        case OS_TOK_SUBTRACT:
+        case OS_TOK_MULTIPLY:
+        case OS_TOK_DIVIDE:
+        case OS_TOK_EQUAL:
+        case OS_TOK_NOT_EQUAL:
+        case OS_TOK_LESS_THAN:
+        case OS_TOK_GREATER_THAN:
+        case OS_TOK_LESS_THAN_EQUAL:
+        case OS_TOK_GREATER_THAN_EQUAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void specializeNode(node_t index) {
+    struct NODE *node = getNode(index);
+
+    for (node_t child = node->child; child; child = getNode(child)->next) {
+        specializeNode(child);
+    }
+
+    if (node->data.type != ET_OPERATOR) return;
+
+    struct op_t &op = node->data.operand.op;
+
+    if (op.handler.binary != nullptr && isRealOperator(op.token) && isReal(node->child) &&
+        isReal(getNode(node->child)->next)) {
+        op.real = true;
+        realOperators++;
+    }
+}
+
+/**
+ * Infers which operators always get two real numbers, and marks them so they skip the dispatch on the operand types.
+ * A variable is real if it is real or undefined when the program starts, and only real values are stored to it, which
+ * is repeated until no more variables turn out to be complex. Variables can still change outside of the program's
+ * stores, like with Input or another program, so the specialized operators check the types anyway and fall back to
+ * the generic operator.
+ * @param root First node of the program
+ */
+static void inferTypes(node_t root) {
+    realOperators = 0;
+
+    for (unsigned int i = 0; i < 27; i++) {
+        complexVariables[i] = variables[i] != nullptr && variables[i]->complex;
+    }
+
+    bool changed;
+    do {
+        changed = false;
+
+        for (node_t node = root; node; node = getNode(node)->next) {
+            if (markComplexStores(node)) changed = true;
+        }
+    } while (changed);
+
+    for (node_t node = root; node; node = getNode(node)->next) {
+        specializeNode(node);
+    }
+
+    STATS_COUNT(realOperators, realOperators);
+}
+
+static unsigned int fusedExpressions;
+
+// The operators which apply element-wise to real lists, without any error
+static bool isElementWise(struct NODE *node) {
+    if (node->data.type != ET_OPERATOR || node->data.operand.op.handler.binary == nullptr) return false;
+
+    const struct op_t &op = node->data.operand.op;
+
+    switch (op.token) {
+        case OS_TOK_NEGATIVE:
+            return true;
+        case OS_TOK_ADD:
+        case OS_TOK_SUBTRACT:
+        case OS_TOK_MULTIPLY:
+            // Unless the handler was replaced, like for [A]⁻¹[B]
+            return op.handler.binary == getBinaryOperator(op.token);
+        default:
+            return false;
+    }
+}
+
+// Checks whether an element-wise operator has a list as operand, otherwise it's better off as a leaf
+static bool hasListOperand(node_t index) {
+    struct NODE *node = getNode(index);
+
+    if (node->data.type == ET_LIST || node->data.type == ET_CUSTOM_LIST) return true;
+    if (!isElementWise(node)) return false;
+
+    for (node_t child = node->child; child; child = getNode(child)->next) {
+        if (hasListOperand(child)) return true;
+    }
+
+    return false;
+}
+
+struct fusion {
+    uint8_t code[FUSED_MAX_LENGTH];
+    unsigned int length;
+    unsigned int depth;
+    node_t leaves[FUSED_MAX_LEAVES];
+    unsigned int leafCount;
+    node_t operators[FUSED_MAX_LENGTH];
+    unsigned int operatorCount;
+};
+
+/**
+ * Appends a node to the postfix code of a fused expression. Everything which is not an element-wise operator on lists
+ * becomes a leaf, which is evaluated once.
+ * @return false if the expression is too large
+ */
+static bool addToFusion(struct fusion &fusion, node_t index) {
+    struct NODE *node = getNode(index);
+
+    if (fusion.length == FUSED_MAX_LENGTH) return false;
+
+    if (!isElementWise(node) || !hasListOperand(index)) {
+        if (fusion.leafCount == FUSED_MAX_LEAVES || fusion.depth == FUSED_MAX_DEPTH) return false;
+
+        fusion.code[fusion.length++] = FUSED_LEAF;
+        fusion.leaves[fusion.leafCount++] = index;
+        fusion.depth++;
+
+        return true;
+    }
+
+    for (node_t child = node->child; child; child = getNode(child)->next) {
+        if (!addToFusion(fusion, child)) return false;
+    }
+
+    if (fusion.length == FUSED_MAX_LENGTH) return false;
+
+    uint8_t token = node->data.operand.op.token;
+
+    fusion.code[fusion.length++] = token;
+    fusion.operators[fusion.operatorCount++] = index;
+    if (token != OS_TOK_NEGATIVE) fusion.depth--;
+
+    return true;
+}
+
+/**
+ * Replaces a tree of element-wise operators on lists by a single fused node, with the leaves as its children. A
+ * single operator already runs in one loop, so it's only worth it for 2 or more.
+ */
+static void fuseNode(node_t index) {
+    struct fusion fusion;
+
+    fusion.length = fusion.depth = fusion.leafCount = fusion.operatorCount = 0;
+
+    if (!isElementWise(getNode(index)) || !hasListOperand(index) || !addToFusion(fusion, index) ||
+        fusion.operatorCount < 2) {
+        for (node_t child = getNode(index)->child; child; child = getNode(child)->next) {
+            fuseNode(child);
+        }
+
+        return;
+    }
+
+    auto fused = static_cast<struct fused_expr *>(operator new(sizeof(struct fused_expr) + fusion.length));
+
+    fused->leaves = fusion.leafCount;
+    fused->length = fusion.length;
+    memcpy(fused->code, fusion.code, fusion.length);
+
+    // The operators are in postfix order, so the last one is this node itself
+    for (unsigned int i = 0; i < fusion.operatorCount - 1; i++) {
+        freeNode(fusion.operators[i]);
+    }
+
+    for (unsigned int i = 0; i < fusion.leafCount; i++) {
+        getNode(fusion.leaves[i])->next = i + 1 < fusion.leafCount ? fusion.leaves[i + 1] : 0;
+        fuseNode(fusion.leaves[i]);
+    }
+
+    struct NODE *node = getNode(index);
+
+    node->data.type = ET_FUSED;
+    node->data.operand.fused = fused;
+    node->child = fusion.leaves[0];
+
+    fusedExpressions++;
+}
+
+/**
+ * Folds constant expressions like 2π/360 into a single number, and simplifies identities like x*1, x+0 and x^2. This
+ * runs between parseProgram() and the evaluation, and only changes the tree in place. Afterwards, the operators which
+ * only get real numbers are specialized, and element-wise list expressions are fused.
+ * @param root First node of the program, as returned by parseProgram()
+ */
+void optimizeProgram(node_t root) {
+    modeCanChange = false;
+    foldedNodes = 0;
+
+    for (node_t node = root; node; node = getNode(node)->next) {
+        if (changesMode(node)) modeCanChange = true;
+    }
+
+    for (node_t node = root; node; node = getNode(node)->next) {
+        optimizeNode(node);
+    }
+
+    STATS_COUNT(foldedNodes, foldedNodes);
+
+    inferTypes(root);
+
+    fusedExpressions = 0;
+
+    for (node_t node = root; node; node = getNode(node)->next) {
+        fuseNode(node);
+    }
+
+    STATS_COUNT(fusedExpressions, fusedExpressions);
+}
@@ -0,0 +1,8 @@
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "ast.h"
+
+void optimizeProgram(node_t root);
+
+#endif
@@ -1,37 +1,44 @@
 #include "parse.h"
 #include "ast.h"
 #include "errors.h"
+#include "functions.h"
 #include "utils.h"
 #include "operators.h"
 #include "variables.h"
 
 #include <cmath>
+#include <cstdio>
 #include <cstring>
-#include <fileioc.h>
 #include <keypadc.h>
 #include <ti/tokens.h>
 
-extern struct NODE *(*parseFunctions[256])(ti_var_t, int);
+extern node_t (*parseFunctions[256])(int);
 
 unsigned int parseLine = 1;
 unsigned int parseCol = 0;
 
 // tinystl::vector<struct NODE *> outputStack doesn't work, linking keeps freezing and not generating code
 // in the allowed number of passes. Design flaw somewhere?
-static struct NODE *outputStack[500];
-static struct NODE *opStack[100];
+static node_t outputStack[500];
+static node_t opStack[100];
 static unsigned int outputStackNr;
 static unsigned int opStackNr;
 static uint8_t nestedFuncs = 0;
 static bool needMulOp;
 
-static void addToOutput(struct NODE *tmp) {
+// Label names are 1 or 2 characters out of 0-9, A-Z and theta, which gives each label its own slot, so there are no
+// collisions to handle. The table is filled while parsing, after which all Goto's can be pointed to their label.
+#define LABEL_CHARS 37
+#define MAX_LABELS (LABEL_CHARS * (LABEL_CHARS + 1))
+static node_t labels[MAX_LABELS];
+
+static void addToOutput(node_t tmp) {
     if (outputStackNr == 500) memoryError();
 
     outputStack[outputStackNr++] = tmp;
 }
 
-static void addToStack(struct NODE *tmp) {
+static void addToStack(node_t tmp) {
     if (opStackNr == 100) memoryError();
 
     opStack[opStackNr++] = tmp;
@@ -40,11 +47,11 @@ static void addToStack(struct NODE *tmp) {
 static void pushOp(uint8_t precedence, int token) {
     while (opStackNr) {
         // Previous element on the stack should be an operator
-        struct NODE *prev = opStack[opStackNr - 1];
+        struct NODE *prev = getNode(opStack[opStackNr - 1]);
         if (prev->data.type != ET_OPERATOR) break;
 
         // Check if we need to move the previous operator to the output stack
-        uint8_t prevPrec = getOpPrecedence(prev->data.operand.op);
+        uint8_t prevPrec = prev->data.operand.op.precedence;
         if (prevPrec > precedence ||
             (prevPrec == precedence && (token == OS_TOK_POWER || token == OS_TOK_NEGATIVE || token == OS_TOK_COMMA)))
             break;
@@ -55,14 +62,14 @@ static void pushOp(uint8_t precedence, int token) {
 
             prev->child = outputStack[outputStackNr - 1];
 
-            outputStack[outputStackNr - 1] = prev;
+            outputStack[outputStackNr - 1] = opStack[opStackNr - 1];
         } else {
             if (outputStackNr < 2) parseError("Syntax error");
 
             prev->child = outputStack[outputStackNr - 2];
-            prev->child->next = outputStack[outputStackNr - 1];
+            getNode(prev->child)->next = outputStack[outputStackNr - 1];
 
-            outputStack[outputStackNr - 2] = prev;
+            outputStack[outputStackNr - 2] = opStack[opStackNr - 1];
             outputStackNr--;
         }
 
@@ -70,6 +77,28 @@ static void pushOp(uint8_t precedence, int token) {
     }
 }
 
+/**
+ * Element access like L1(I) or [A](R,C) is parsed as a function call first, and then gets its own node, which reads the
+ * element directly from the variable
+ */
+static void resolveElement(struct NODE *funcNode) {
+    const struct func_t &func = funcNode->data.operand.func;
+    uint8_t type = func.token;
+    uint8_t variableNr = func.token >> 8;
+
+    if (type == OS_TOK_LIST) {
+        if (func.argc != 1) argumentsError();
+
+        funcNode->data.type = ET_LIST_ELEMENT;
+        funcNode->data.operand.listNr = variableNr;
+    } else if (type == OS_TOK_MATRIX) {
+        if (func.argc != 2) argumentsError();
+
+        funcNode->data.type = ET_MATRIX_ELEMENT;
+        funcNode->data.operand.matrixNr = variableNr;
+    }
+}
+
 static void pushRParen(uint8_t tok) {
     uint8_t argCount = 1;
 
@@ -78,63 +107,69 @@ static void pushRParen(uint8_t tok) {
     // Search for the matching left parenthesis/bracket. Everything we encounter can only be a comma, which is used in a
     // function. If any comma is found, it must be function, as (1, 2) is invalid.
     for (unsigned int i = opStackNr; i-- > 0;) {
-        struct NODE *tmp = opStack[i];
+        struct NODE *tmp = getNode(opStack[i]);
 
-        if (tmp->data.type == ET_FUNCTION_CALL && tmp->data.operand.func == tok) {
+        if (tmp->data.type == ET_FUNCTION_CALL && tmp->data.operand.func.token == tok) {
             // This is the closing } or ) which is a single function without an extra parenthesis
             if (argCount <= outputStackNr && (tok == OS_TOK_LEFT_BRACE || tok == OS_TOK_LEFT_BRACKET)) {
-                struct NODE *tree = tmp->child = outputStack[outputStackNr - argCount];
+                node_t tree = tmp->child = outputStack[outputStackNr - argCount];
+
+                tmp->data.operand.func.argc = argCount;
 
                 // Set the arguments of the function
                 for (uint8_t j = 1; j < argCount; j++) {
-                    tree->next = outputStack[outputStackNr - argCount + j];
-                    tree = tree->next;
+                    tree = getNode(tree)->next = outputStack[outputStackNr - argCount + j];
                 }
 
                 outputStackNr -= argCount;
                 opStackNr--;
 
                 // Insert the function in the output queue
-                addToOutput(tmp);
+                addToOutput(opStack[i]);
 
                 return;
-            } else if (i && argCount <= outputStackNr && opStack[i - 1]->data.type == ET_FUNCTION_CALL &&
-                       opStack[i - 1]->data.operand.func != OS_TOK_LEFT_PAREN) {
+            } else if (i && argCount <= outputStackNr && getNode(opStack[i - 1])->data.type == ET_FUNCTION_CALL &&
+                       getNode(opStack[i - 1])->data.operand.func.token != OS_TOK_LEFT_PAREN) {
                 // This is a real function, like sin or cos. Free the parenthesis, and set all arguments from the
                 // output queue as the children of this function.
-                struct NODE *funcNode = opStack[i - 1];
-                struct NODE *tree = funcNode->child = outputStack[outputStackNr - argCount];
+                struct NODE *funcNode = getNode(opStack[i - 1]);
+                node_t tree = funcNode->child = outputStack[outputStackNr - argCount];
 
-                free(tmp);
+                freeNode(opStack[i]);
+
+                // Resolve the function already, so it doesn't need to be looked up every time it's evaluated
+                struct func_t &func = funcNode->data.operand.func;
+                func.argc = argCount;
+                if (argCount == 1) func.handler = getUnaryFunction(func.token);
+                resolveElement(funcNode);
 
                 // Set the arguments of the function
                 for (uint8_t j = 1; j < argCount; j++) {
-                    tree->next = outputStack[outputStackNr - argCount + j];
-                    tree = tree->next;
+                    tree = getNode(tree)->next = outputStack[outputStackNr - argCount + j];
                 }
 
                 outputStackNr -= argCount;
                 opStackNr -= 2;
 
                 // Insert the function in the output queue
-                addToOutput(funcNode);
+                addToOutput(opStack[i - 1]);
 
                 return;
             } else if (argCount == 1) {
                 // It is a standalone parenthesis, it should have only 1 argument. Only free the stack entry, as the
                 // last output queue item is already the correct one.
-                free(tmp);
+                freeNode(opStack[i]);
                 opStackNr--;
 
                 return;
             } else {
                 break;
             }
-        } else if (tmp->data.type == ET_OPERATOR && tmp->data.operand.op == OS_TOK_COMMA) {
+        } else if (tmp->data.type == ET_OPERATOR && tmp->data.operand.op.token == OS_TOK_COMMA) {
             argCount++;
             opStackNr--;
 
-            free(tmp);
+            freeNode(opStack[i]);
         } else {
             break;
         }
@@ -147,22 +182,22 @@ static void emptyOpStack() {
     for (unsigned int i = opStackNr; i-- > 0;) {
         if (i >= opStackNr) continue;
 
-        struct NODE *tmp = opStack[i];
+        struct NODE *tmp = getNode(opStack[i]);
 
         if (tmp->data.type == ET_OPERATOR) pushOp(MAX_PRECEDENCE + 1, MAX_PRECEDENCE + 1);
-        else if (tmp->data.type == ET_FUNCTION_CALL) pushRParen(tmp->data.operand.func);
+        else if (tmp->data.type == ET_FUNCTION_CALL) pushRParen(tmp->data.operand.func.token);
     }
 
     if (outputStackNr != 1) parseError("Invalid expression");
 }
 
-static struct NODE *tokenUnimplemented(__attribute__((unused)) ti_var_t slot, __attribute__((unused)) int token) {
+static node_t tokenUnimplemented(__attribute__((unused)) int token) {
     parseError("Token not implemented");
 }
 
-#define UNEXPRESSION(func) (reinterpret_cast<void (*)(ti_var_t, int)>(((unsigned int *)(func) + 0x800000)))
+#define UNEXPRESSION(func) (reinterpret_cast<void (*)(int)>(((unsigned int *)(func) + 0x800000)))
 
-struct NODE *expressionLine(ti_var_t slot, int token, bool stopAtComma, bool stopAtParen) {
+node_t expressionLine(int token, bool stopAtComma, bool stopAtParen) {
     // Reset expression things
     outputStackNr = 0;
     opStackNr = 0;
@@ -176,14 +211,14 @@ struct NODE *expressionLine(ti_var_t slot, int token, bool stopAtComma, bool sto
 
         auto func = parseFunctions[token];
         if ((unsigned int)((uint64_t)(func)) >= 0x800000) {
-            tokenUnimplemented(slot, token);
+            tokenUnimplemented(token);
         }
 
         // Execute the token function
-        (*UNEXPRESSION(func))(slot, token);
+        (*UNEXPRESSION(func))(token);
 
         // And get the new token
-        token = tokenNext(slot);
+        token = tokenNext();
     }
 
     emptyOpStack();
@@ -193,12 +228,13 @@ struct NODE *expressionLine(ti_var_t slot, int token, bool stopAtComma, bool sto
 
 #undef UNEXPRESSION
 
-static void tokenOperator(__attribute__((unused)) ti_var_t slot, int token) {
+static void tokenOperator(int token) {
     needMulOp = false;
 
     if (token == OS_TOK_STO) {
         // Multiple stores are not implemented
-        if (opStackNr && opStack[0]->data.type == ET_OPERATOR && opStack[0]->data.operand.op == OS_TOK_STO)
+        if (opStackNr && getNode(opStack[0])->data.type == ET_OPERATOR &&
+            getNode(opStack[0])->data.operand.op.token == OS_TOK_STO)
             parseError("Syntax error");
 
         emptyOpStack();
@@ -209,14 +245,24 @@ static void tokenOperator(__attribute__((unused)) ti_var_t slot, int token) {
     pushOp(op_precedence, token);
 
     // And allocate memory for the new operator
-    auto op_node = new NODE();
-    op_node->data.type = ET_OPERATOR;
-    op_node->data.operand.op = token;
+    node_t op_node = newNode(ET_OPERATOR);
+    struct op_t &op = getNode(op_node)->data.operand.op;
+    op.token = token;
+    op.precedence = op_precedence;
+
+    if (isUnaryOp(op_precedence)) {
+        op.handler.unary = getUnaryOperator(token);
+    } else {
+        op.handler.binary = getBinaryOperator(token);
+    }
 
     addToStack(op_node);
+
+    // A value right after a postfix operator is multiplied, like in [A]⁻¹[B]
+    needMulOp = isUnaryOp(op_precedence) && token != OS_TOK_NEGATIVE;
 }
 
-static void tokenRBrack(ti_var_t slot, int token) {
+static void tokenRBrack(int token) {
     needMulOp = true;
 
     pushOp(MAX_PRECEDENCE + 1, token);
@@ -225,18 +271,18 @@ static void tokenRBrack(ti_var_t slot, int token) {
     // Check if a "[" is coming, in which case we need an extra comma
     token = tokenPeek();
     if ((uint8_t) token == OS_TOK_LEFT_BRACKET) {
-        tokenOperator(slot, OS_TOK_COMMA);
+        tokenOperator(OS_TOK_COMMA);
     }
 }
 
-static void tokenRBrace(__attribute__((unused)) ti_var_t slot, __attribute__((unused)) int token) {
+static void tokenRBrace(__attribute__((unused)) int token) {
     needMulOp = true;
 
     pushOp(MAX_PRECEDENCE + 1, token);
     pushRParen(OS_TOK_LEFT_BRACE);
 }
 
-static void tokenRParen(__attribute__((unused)) ti_var_t slot, __attribute__((unused)) int token) {
+static void tokenRParen(__attribute__((unused)) int token) {
     needMulOp = true;
 
     // This forces all operators to be moved to the output stack
@@ -245,28 +291,26 @@ static void tokenRParen(__attribute__((unused)) ti_var_t slot, __attribute__((un
     pushRParen(OS_TOK_LEFT_PAREN);
 }
 
-static void tokenFunction(ti_var_t slot, int token) {
-    if (needMulOp) tokenOperator(slot, OS_TOK_MULTIPLY);
+static void tokenFunction(int token) {
+    if (needMulOp) tokenOperator(OS_TOK_MULTIPLY);
 
     // Allocate space for the function
-    auto node = new NODE();
-    node->data.type = ET_FUNCTION_CALL;
-    node->data.operand.func = token;
+    node_t node = newNode(ET_FUNCTION_CALL);
+    getNode(node)->data.operand.func.token = token;
 
     addToStack(node);
     nestedFuncs++;
 
     if (token != OS_TOK_LEFT_PAREN && token != OS_TOK_LEFT_BRACE && token != OS_TOK_LEFT_BRACKET) {
         // Eventually push an extra (
-        auto parenNode = new NODE();
-        parenNode->data.type = ET_FUNCTION_CALL;
-        parenNode->data.operand.func = OS_TOK_LEFT_PAREN;
+        node_t parenNode = newNode(ET_FUNCTION_CALL);
+        getNode(parenNode)->data.operand.func.token = OS_TOK_LEFT_PAREN;
 
         addToStack(parenNode);
     }
 }
 
-static void tokenNumber(ti_var_t slot, int token) {
+static void tokenNumber(int token) {
     float num = 0;
     bool inExp = false;
     bool negativeExp = false;
@@ -276,7 +320,7 @@ static void tokenNumber(ti_var_t slot, int token) {
     uint8_t expNum = 0;
     uint8_t tok = token;
 
-    if (needMulOp) tokenOperator(slot, OS_TOK_MULTIPLY);
+    if (needMulOp) tokenOperator(OS_TOK_MULTIPLY);
     needMulOp = true;
 
     // Set some booleans
@@ -290,7 +334,7 @@ static void tokenNumber(ti_var_t slot, int token) {
         num = (float) tok - OS_TOK_0;
     }
 
-    while ((token = tokenNext(slot)) != EOF) {
+    while ((token = tokenNext()) != EOF) {
         tok = token;
 
         // Should be a valid num char
@@ -323,194 +367,298 @@ static void tokenNumber(ti_var_t slot, int token) {
         }
     }
 
-    if (token != OS_TOK_IMAGINARY) seekPrev(slot);
+    if (token != OS_TOK_IMAGINARY) seekPrev();
 
     // Get the right number, based on the exponent and negative flag
     if (negativeExp) exp = -exp;
     if (inExp) num = num * powf(10, (float) exp);
 
     // And add it to the output stack
-    auto node = new NODE();
     if (isComplex) {
-        node->data.type = ET_COMPLEX;
-        node->data.operand.cplx = new Complex(0, num);
+        node_t node = newNode(ET_COMPLEX);
+        getNode(node)->data.operand.num = num;
 
         addToOutput(node);
     } else {
-        node->data.type = ET_NUMBER;
-        node->data.operand.num = new Number(num);
+        node_t node = newNode(ET_NUMBER);
+        getNode(node)->data.operand.num = num;
 
         addToOutput(node);
     }
 }
 
-static void tokenVariable(__attribute__((unused)) ti_var_t slot, int token) {
-    if (needMulOp) tokenOperator(slot, OS_TOK_MULTIPLY);
+static void tokenVariable(int token) {
+    if (needMulOp) tokenOperator(OS_TOK_MULTIPLY);
     needMulOp = true;
 
-    auto node = new NODE();
-    node->data.type = ET_VARIABLE;
-    node->data.operand.variableNr = token - OS_TOK_A;
+    node_t node = newNode(ET_VARIABLE);
+    getNode(node)->data.operand.variableNr = token - OS_TOK_A;
 
     addToOutput(node);
 }
 
-static void tokenOSList(ti_var_t slot, __attribute__((unused)) int token) {
-    if (needMulOp) tokenOperator(slot, OS_TOK_MULTIPLY);
+static void tokenOSList(__attribute__((unused)) int token) {
+    if (needMulOp) tokenOperator(OS_TOK_MULTIPLY);
 
-    uint8_t listNr = tokenNext(slot);
+    uint8_t listNr = tokenNext();
 
     // Check if it's a list element
     if (tokenPeek() == OS_TOK_LEFT_PAREN) {
-        tokenNext(slot);
-        tokenFunction(slot, 0x5D + (listNr << 8));
+        tokenNext();
+        tokenFunction(OS_TOK_LIST + (listNr << 8));
     } else {
-        auto node = new NODE();
-        node->data.type = ET_LIST;
-        node->data.operand.listNr = listNr;
+        node_t node = newNode(ET_LIST);
+        getNode(node)->data.operand.listNr = listNr;
 
         addToOutput(node);
         needMulOp = true;
     }
 }
 
-static void tokenOSMatrix(ti_var_t slot, __attribute__((unused)) int token) {
-    if (needMulOp) tokenOperator(slot, OS_TOK_MULTIPLY);
+static void tokenOSMatrix(__attribute__((unused)) int token) {
+    if (needMulOp) tokenOperator(OS_TOK_MULTIPLY);
 
-    uint8_t matrixNr = tokenNext(slot);
+    uint8_t matrixNr = tokenNext();
 
     // Check if it's a matrix element
     if (tokenPeek() == OS_TOK_LEFT_PAREN) {
-        tokenNext(slot);
-        tokenFunction(slot, 0x5C + (matrixNr << 8));
+        tokenNext();
+        tokenFunction(OS_TOK_MATRIX + (matrixNr << 8));
     } else {
-        auto node = new NODE();
-        node->data.type = ET_MATRIX;
-        node->data.operand.matrixNr = matrixNr;
+        node_t node = newNode(ET_MATRIX);
+        getNode(node)->data.operand.matrixNr = matrixNr;
 
         addToOutput(node);
         needMulOp = true;
     }
 }
 
-static void tokenOsString(ti_var_t slot, __attribute__((unused)) int token) {
-    if (needMulOp) tokenOperator(slot, OS_TOK_MULTIPLY);
+static void tokenOsString(__attribute__((unused)) int token) {
+    if (needMulOp) tokenOperator(OS_TOK_MULTIPLY);
     needMulOp = true;
 
-    uint8_t strNr = tokenNext(slot);
+    uint8_t strNr = tokenNext();
 
-    auto node = new NODE();
-    node->data.type = ET_STRING;
-    node->data.operand.stringNr = strNr;
+    node_t node = newNode(ET_STRING);
+    getNode(node)->data.operand.stringNr = strNr;
 
     addToOutput(node);
 }
 
-static void tokenOsEqu(ti_var_t slot, __attribute__((unused)) int token) {
-    if (needMulOp) tokenOperator(slot, OS_TOK_MULTIPLY);
+static void tokenOsEqu(__attribute__((unused)) int token) {
+    if (needMulOp) tokenOperator(OS_TOK_MULTIPLY);
     needMulOp = true;
 
-    uint8_t equNr = tokenNext(slot);
+    uint8_t equNr = tokenNext();
 
     if (equNr >= 0x80) equNr -= 0x80 - 28;
     else if (equNr >= 0x40) equNr -= 0x40 - 22;
     else if (equNr >= 0x20) equNr -= 0x20 - 10;
 
-    auto node = new NODE();
-    node->data.type = ET_EQU;
-    node->data.operand.equationNr = equNr;
+    node_t node = newNode(ET_EQU);
+    getNode(node)->data.operand.equationNr = equNr;
 
     addToOutput(node);
 }
 
-static void tokenString(ti_var_t slot, int token) {
-    if (needMulOp) tokenOperator(slot, OS_TOK_MULTIPLY);
+static void tokenString(int token) {
+    if (needMulOp) tokenOperator(OS_TOK_MULTIPLY);
 
-    uint8_t *startPtr = (uint8_t *) ti_GetDataPtr(slot) + 1;
+    const uint8_t *startPtr = tokenPtr();
     unsigned int length = 0;
 
     do {
-        token = tokenNext(slot);
+        token = tokenNext();
         length++;
 
         if (is2ByteTok(token)) {
-            tokenNext(slot);
+            tokenNext();
             length++;
         }
     } while (token != EOF && (uint8_t) token != OS_TOK_NEWLINE && (uint8_t) token != OS_TOK_STO && (uint8_t) token != OS_TOK_DOUBLE_QUOTE);
 
     if ((uint8_t) token == OS_TOK_NEWLINE || (uint8_t) token == OS_TOK_STO) {
-        seekPrev(slot);
+        seekPrev();
     } else {
         needMulOp = true;
     }
 
-    // This is a fake struct NODE, in fact it's just a pointer to the raw string
     auto stringMemory = (struct var_string *) new char[length - 1 + 3];
 
     stringMemory->length = length - 1;
     memcpy(stringMemory->data, startPtr, length - 1);
 
-    auto node = new NODE();
-    node->data.type = ET_FUNCTION_CALL;
-    node->data.operand.func = OS_TOK_DOUBLE_QUOTE;
-    node->child = (struct NODE *) stringMemory;
+    node_t node = newNode(ET_STRING_LITERAL);
+    getNode(node)->data.operand.string = stringMemory;
 
     addToOutput(node);
 }
 
-static void tokenEmptyFunc(__attribute__((unused)) ti_var_t slot, int token) {
-    if (needMulOp) tokenOperator(slot, OS_TOK_MULTIPLY);
+static void tokenEmptyFunc(int token) {
+    if (needMulOp) tokenOperator(OS_TOK_MULTIPLY);
     needMulOp = true;
 
-    auto node = new NODE();
-    node->data.type = ET_FUNCTION_CALL;
-    node->data.operand.func = token;
+    node_t node = newNode(ET_FUNCTION_CALL);
+    getNode(node)->data.operand.func.token = token;
 
     addToOutput(node);
 }
 
-static void tokenPi(__attribute__((unused)) ti_var_t slot, __attribute__((unused)) int token) {
-    if (needMulOp) tokenOperator(slot, OS_TOK_MULTIPLY);
+static void tokenAns(__attribute__((unused)) int token) {
+    if (needMulOp) tokenOperator(OS_TOK_MULTIPLY);
     needMulOp = true;
 
-    auto node = new NODE();
-    node->data.type = ET_NUMBER;
-    node->data.operand.num = new Number(M_PI);
+    addToOutput(newNode(ET_ANS));
+}
+
+static void tokenPi(__attribute__((unused)) int token) {
+    if (needMulOp) tokenOperator(OS_TOK_MULTIPLY);
+    needMulOp = true;
+
+    node_t node = newNode(ET_NUMBER);
+    getNode(node)->data.operand.num = M_PI;
 
     addToOutput(node);
 }
 
-static void tokenRand(ti_var_t slot, __attribute__((unused)) int token) {
-    if (needMulOp) tokenOperator(slot, OS_TOK_MULTIPLY);
+static void tokenRand(__attribute__((unused)) int token) {
+    if (needMulOp) tokenOperator(OS_TOK_MULTIPLY);
 
     // Check if it's a matrix element
     if (tokenPeek() == OS_TOK_LEFT_PAREN) {
-        tokenNext(slot);
-        tokenFunction(slot, OS_TOK_RAND);
+        tokenNext();
+        tokenFunction(OS_TOK_RAND);
     } else {
-        auto node = new NODE();
-        node->data.type = ET_FUNCTION_CALL;
-        node->data.operand.func = OS_TOK_RAND;
+        node_t node = newNode(ET_FUNCTION_CALL);
+        getNode(node)->data.operand.func.token = OS_TOK_RAND;
 
         addToOutput(node);
         needMulOp = true;
     }
 }
 
+static void token2Byte(int token) {
+    int function = token + (tokenNext() << 8);
+
+    switch (function) {
+        case FUNC_REF:
+        case FUNC_RREF:
+            tokenFunction(function);
+            break;
+        default:
+            tokenUnimplemented(function);
+    }
+}
+
+static uint8_t labelChar(int token) {
+    if (token >= OS_TOK_0 && token <= OS_TOK_9) return token - OS_TOK_0;
+    if (token >= OS_TOK_A && token <= OS_TOK_THETA) return token - OS_TOK_A + 10;
+
+    parseError("Invalid label");
+}
+
+/**
+ * Reads the name of a label after Lbl or Goto
+ * @return Index of the label in labels[]
+ */
+static uint16_t parseLabelName() {
+    uint16_t label = labelChar(tokenNext());
+
+    if (!endOfLine(tokenPeek())) {
+        label = label * (LABEL_CHARS + 1) + labelChar(tokenNext()) + 1;
+
+        if (!endOfLine(tokenPeek())) parseError("Invalid label");
+    } else {
+        label *= LABEL_CHARS + 1;
+    }
+
+    return label;
+}
+
+/**
+ * Points every Goto to its label, now that all labels are known. A Goto to a label that doesn't exist only raises an
+ * error when it's executed, just like the OS does.
+ * @param root First statement of the program
+ */
+static void resolveLabels(node_t root) {
+    for (node_t node = root; node; node = getNode(node)->next) {
+        struct NODE *tmp = getNode(node);
+
+        if (tmp->data.type == ET_CONTROL && tmp->data.operand.control.token == OS_TOK_GOTO) {
+            tmp->data.operand.control.target = labels[tmp->data.operand.control.label];
+        }
+    }
+}
+
 /**
- * This function parses the entire program, reading it line by line
- * @param slot fileioc slot to read the data from
+ * Parses a single statement. Block statements are returned together with their body, as a chain of statements.
+ * @param token First token of the statement
+ * @return First node of the statement, or 0 if there is nothing to run
+ */
+static node_t parseStatement(int token) {
+    auto func = parseFunctions[token];
+    node_t node;
+    if ((unsigned int)(uint64_t)(func) < 0x800000) {
+        node = expressionLine(token, false, false);
+    } else {
+        node = (*func)(token);
+    }
+
+    // Advance line and column
+    parseLine++;
+    parseCol = 0;
+
+    return node;
+}
+
+static node_t lastStatement(node_t node) {
+    while (getNode(node)->next) node = getNode(node)->next;
+
+    return node;
+}
+
+static node_t newControl(uint8_t token) {
+    node_t node = newNode(ET_CONTROL);
+    getNode(node)->data.operand.control.token = token;
+
+    return node;
+}
+
+/**
+ * Parses the body of a block until its End, and appends it to the block
+ * @param tail Last statement of the block so far
+ * @param expectElse Whether the body may stop at an Else, which is only valid in an If-statement
+ * @return Last statement of the body, or tail if the body is empty
+ */
+static node_t parseBody(node_t tail, bool expectElse) {
+    node_t body = parseProgram(true, expectElse);
+    int token = tokenCurrent();
+
+    if (token != OS_TOK_END && (token != OS_TOK_ELSE || !expectElse)) parseError("Missing \"End\"");
+
+    if (!body) return tail;
+
+    getNode(tail)->next = body;
+
+    return lastStatement(body);
+}
+
+/**
+ * This function parses the entire program, reading it line by line from the program set by tokenInit()
  * @param expectEnd Boolean to allow stopping the program at "End", which is after a loop/statement
  * @param expectElse Boolean to allow stopping the program at "Else", which is inside an If-statement
  * @return Node to start parsing at (i.e. the root)
  */
-struct NODE *parseProgram(ti_var_t slot, bool expectEnd, bool expectElse) {
+node_t parseProgram(bool expectEnd, bool expectElse) {
     int token;
-    struct NODE *root = nullptr;
-    struct NODE *tail = nullptr;
+    node_t root = 0;
+    node_t tail = 0;
+
+    // Only the whole program can contain labels which aren't defined yet
+    bool isProgram = !expectEnd && !expectElse;
+    if (isProgram) memset(labels, 0, sizeof(labels));
 
-    while ((token = tokenNext(slot)) != EOF) {
+    while ((token = tokenNext()) != EOF) {
         if (kb_On) parseError("[ON]-key pressed");
 
         // Skip if's a colon
@@ -522,62 +670,52 @@ struct NODE *parseProgram(ti_var_t slot, bool expectEnd, bool expectElse) {
         if ((token == OS_TOK_END && expectEnd) || (token == OS_TOK_ELSE && expectElse))
             return root;
 
-        auto func = parseFunctions[token];
-        struct NODE *node;
-        if ((unsigned int)(uint64_t)(func) < 0x800000) {
-            node = expressionLine(slot, token, false, false);
-        } else {
-            node = (*func)(slot, token);
-        }
-
-        // Advance line and column
-        parseLine++;
-        parseCol = 0;
+        node_t node = parseStatement(token);
 
         // Need to insert it?
-        if (node == nullptr)
+        if (!node)
             continue;
 
         // Insert it to the chain
-        if (root == nullptr) {
-            root = tail = node;
+        if (!root) {
+            root = node;
         } else {
-            tail->next = node;
-            tail = node;
+            getNode(tail)->next = node;
         }
+
+        tail = lastStatement(node);
     }
 
+    if (isProgram) resolveLabels(root);
+
     return root;
 }
 
-static struct NODE *tokenCommandStandalone(__attribute__((unused)) ti_var_t slot, int token) {
+static node_t tokenCommandStandalone(int token) {
     if (!endOfLine(tokenPeek())) parseError("Syntax error");
 
-    auto func_node = new NODE();
-    func_node->data.type = ET_FUNCTION_CALL;
-    func_node->data.operand.func = token;
+    node_t func_node = newNode(ET_FUNCTION_CALL);
+    getNode(func_node)->data.operand.func.token = token;
 
     return func_node;
 }
 
-static struct NODE *tokenCommand(ti_var_t slot, int token, bool endParen) {
-    auto commandNode = new NODE();
-    commandNode->data.type = ET_COMMAND;
-    commandNode->data.operand.command = token;
+static node_t tokenCommand(int token, bool endParen) {
+    node_t commandNode = newNode(ET_COMMAND);
+    getNode(commandNode)->data.operand.command = token;
 
-    struct NODE *tree = nullptr;
+    node_t tree = 0;
 
     for (;;) {
-        token = tokenNext(slot);
+        token = tokenNext();
 
         // Get the next expression
-        auto expr = expressionLine(slot, token, true, endParen);
+        auto expr = expressionLine(token, true, endParen);
 
-        if (tree == nullptr) {
-            tree = commandNode->child = expr;
+        if (!tree) {
+            tree = getNode(commandNode)->child = expr;
         } else {
-            tree->next = expr;
-            tree = tree->next;
+            tree = getNode(tree)->next = expr;
         }
 
         token = tokenCurrent();
@@ -587,7 +725,7 @@ static struct NODE *tokenCommand(ti_var_t slot, int token, bool endParen) {
         //  - Comma, in which case we just continue with parsing the next expression
         //  - Right parenthesis, which should be the last token on a line
         if (endOfLine(token)) {
-            seekPrev(slot);
+            seekPrev();
 
             break;
         }
@@ -602,21 +740,144 @@ static struct NODE *tokenCommand(ti_var_t slot, int token, bool endParen) {
     return commandNode;
 }
 
-static struct NODE *tokenCommandArgs(ti_var_t slot, int token) {
-    return tokenCommand(slot, token, false);
+static node_t tokenCommandArgs(int token) {
+    return tokenCommand(token, false);
+}
+
+static node_t tokenCommandParen(int token) {
+    return tokenCommand(token, true);
 }
 
-static struct NODE *tokenCommandParen(ti_var_t slot, int token) {
-    return tokenCommand(slot, token, true);
+static node_t tokenNewline(__attribute__((unused)) int token) {
+    return 0;
 }
 
-static struct NODE *tokenNewline(__attribute__((unused)) ti_var_t slot, __attribute__((unused)) int token) {
-    return nullptr;
+static node_t tokenLbl(int token) {
+    node_t node = newNode(ET_CONTROL);
+    struct control_t &control = getNode(node)->data.operand.control;
+
+    control.token = token;
+    control.label = parseLabelName();
+
+    // If a label is defined multiple times, the OS jumps to the first one
+    if (!labels[control.label]) labels[control.label] = node;
+
+    return node;
 }
 
-#define EXPRESSION(func) (reinterpret_cast<NODE *(*)(ti_var_t, int)>(((unsigned int*)(&(func)) - 0x800000)))
+static node_t tokenGoto(int token) {
+    node_t node = newNode(ET_CONTROL);
+    struct control_t &control = getNode(node)->data.operand.control;
+
+    control.token = token;
+    control.label = parseLabelName();
+
+    return node;
+}
+
+/**
+ * Appends the End of a block
+ * @param tail Last statement of the block
+ * @param opener The statement which started the block
+ * @return The End
+ */
+static node_t addEnd(node_t tail, node_t opener) {
+    node_t end = newControl(OS_TOK_END);
+
+    getNode(end)->data.operand.control.target = opener;
+    getNode(tail)->next = end;
+
+    return end;
+}
+
+static node_t tokenIf(int token) {
+    node_t ifNode = newControl(token);
+    node_t condition = expressionLine(tokenNext(), false, false);
+
+    getNode(ifNode)->child = condition;
+
+    if (tokenCurrent() == EOF) parseError("Syntax error");
+
+    if (tokenPeek() != OS_TOK_THEN) {
+        // Without Then, only the next statement depends on the condition
+        do {
+            token = tokenNext();
+        } while (token == OS_TOK_COLON || token == OS_TOK_NEWLINE);
+
+        if (token == EOF || token == OS_TOK_END || token == OS_TOK_ELSE) parseError("Syntax error");
+
+        node_t statement = parseStatement(token);
+        if (!statement) parseError("Syntax error");
+
+        getNode(ifNode)->next = statement;
+        getNode(ifNode)->data.operand.control.target = lastStatement(statement);
 
-struct NODE *(*parseFunctions[256])(ti_var_t, int) = {
+        return ifNode;
+    }
+
+    tokenNext();
+    if (!endOfLine(tokenPeek())) parseError("Syntax error");
+
+    node_t tail = parseBody(ifNode, true);
+
+    if (tokenCurrent() == OS_TOK_ELSE) {
+        node_t elseNode = newControl(OS_TOK_ELSE);
+
+        getNode(ifNode)->data.operand.control.target = elseNode;
+        getNode(tail)->next = elseNode;
+
+        node_t end = addEnd(parseBody(elseNode, false), ifNode);
+        getNode(elseNode)->data.operand.control.target = end;
+    } else {
+        node_t end = addEnd(tail, ifNode);
+        getNode(ifNode)->data.operand.control.target = end;
+    }
+
+    return ifNode;
+}
+
+static node_t tokenLoop(int token) {
+    node_t loop = newControl(token);
+    node_t condition = expressionLine(tokenNext(), false, false);
+
+    getNode(loop)->child = condition;
+
+    node_t end = addEnd(parseBody(loop, false), loop);
+    getNode(loop)->data.operand.control.target = end;
+
+    return loop;
+}
+
+static node_t tokenFor(int token) {
+    // The arguments are parsed the same as a command, so only check them afterwards
+    node_t loop = tokenCommand(token, true);
+    unsigned int argc = 0;
+
+    for (node_t arg = getNode(loop)->child; arg; arg = getNode(arg)->next) {
+        argc++;
+    }
+
+    if (getNode(getNode(loop)->child)->data.type != ET_VARIABLE || argc < 3 || argc > 4) parseError("Syntax error");
+
+    struct NODE *tmp = getNode(loop);
+
+    tmp->data.type = ET_CONTROL;
+    tmp->data.operand.control.token = token;
+    tmp->data.operand.control.loop = newForLoop();
+
+    node_t end = addEnd(parseBody(loop, false), loop);
+    getNode(loop)->data.operand.control.target = end;
+
+    return loop;
+}
+
+static node_t tokenUnexpected(__attribute__((unused)) int token) {
+    parseError("Syntax error");
+}
+
+#define EXPRESSION(func) (reinterpret_cast<node_t (*)(int)>(((unsigned int*)(&(func)) - 0x800000)))
+
+node_t (*parseFunctions[256])(int) = {
         tokenUnimplemented,                // **unused**
         tokenUnimplemented,                // ►DMS
         tokenUnimplemented,                // ►Dec
@@ -731,7 +992,7 @@ struct NODE *(*parseFunctions[256])(ti_var_t, int) = {
         EXPRESSION(tokenOperator),        // !=
         EXPRESSION(tokenOperator),        // +
         EXPRESSION(tokenOperator),        // - (sub)
-        EXPRESSION(tokenEmptyFunc),       // Ans
+        EXPRESSION(tokenAns),             // Ans
         tokenUnimplemented,               // Fix
         tokenCommandStandalone,           // Horiz
         tokenCommandStandalone,           // Full
@@ -804,7 +1065,7 @@ struct NODE *(*parseFunctions[256])(ti_var_t, int) = {
         EXPRESSION(tokenFunction),        // not(
         EXPRESSION(tokenFunction),        // iPart(
         EXPRESSION(tokenFunction),        // fPart(
-        tokenUnimplemented,               // 2-byte token
+        EXPRESSION(token2Byte),           // 2-byte token
         EXPRESSION(tokenFunction),        // √(
         EXPRESSION(tokenFunction),        // ³√(
         EXPRESSION(tokenFunction),        // ln(
@@ -823,16 +1084,16 @@ struct NODE *(*parseFunctions[256])(ti_var_t, int) = {
         EXPRESSION(tokenFunction),        // coshֿ¹(
         EXPRESSION(tokenFunction),        // tanh(
         EXPRESSION(tokenFunction),        // tanhֿ¹(
-        tokenUnimplemented,               // If
-        tokenUnimplemented,               // Then
-        tokenUnimplemented,               // Else
-        tokenUnimplemented,               // While
-        tokenUnimplemented,               // Repeat
-        tokenUnimplemented,               // For(
-        tokenUnimplemented,               // End
+        tokenIf,                          // If
+        tokenUnexpected,                  // Then
+        tokenUnexpected,                  // Else
+        tokenLoop,                        // While
+        tokenLoop,                        // Repeat
+        tokenFor,                         // For(
+        tokenUnexpected,                  // End
         tokenCommandStandalone,           // Return
-        tokenUnimplemented,               // Lbl
-        tokenUnimplemented,               // Goto
+        tokenLbl,                         // Lbl
+        tokenGoto,                        // Goto
         tokenUnimplemented,               // Pause
         tokenCommandStandalone,           // Stop
         tokenUnimplemented,               // IS>(
@@ -1,8 +1,8 @@
 #ifndef PARSE_H
 #define PARSE_H
 
-#include <fileioc.h>
+#include "ast.h"
 
-struct NODE *parseProgram(ti_var_t slot, bool expectEnd, bool expectElse);
+node_t parseProgram(bool expectEnd, bool expectElse);
 
 #endif
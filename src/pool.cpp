@@ -0,0 +1,69 @@
+#include "pool.h"
+#include "stats.h"
+
+#include <cstdint>
+#include <new>
+
+struct pool pools[POOL_COUNT];
+
+// The smallest pool whose blocks fit the size, or POOL_COUNT if none does
+static unsigned int poolIndex(size_t size) {
+    unsigned int index = 0;
+
+    while (index < POOL_COUNT && (size_t) (POOL_MIN_BLOCK_SIZE << index) < size) {
+        index++;
+    }
+
+    return index;
+}
+
+/**
+ * Allocates a block of memory, like operator new. The size has to be passed to poolFree() again.
+ * @param size Size in bytes
+ * @return The block, it never returns nullptr
+ */
+void *poolAlloc(size_t size) {
+    unsigned int index = poolIndex(size);
+
+    if (index == POOL_COUNT) {
+        STATS_COUNT(poolFallbacks, 1);
+        return operator new(size);
+    }
+
+    struct pool &pool = pools[index];
+
+    if (pool.freeBlocks == nullptr) {
+        size_t blockSize = POOL_MIN_BLOCK_SIZE << index;
+        auto chunk = static_cast<uint8_t *>(operator new(POOL_CHUNK_SIZE));
+
+        for (size_t offset = 0; offset + blockSize <= POOL_CHUNK_SIZE; offset += blockSize) {
+            *reinterpret_cast<void **>(chunk + offset) = pool.freeBlocks;
+            pool.freeBlocks = chunk + offset;
+            pool.capacity++;
+        }
+    }
+
+    void *block = pool.freeBlocks;
+
+    pool.freeBlocks = *static_cast<void **>(block);
+    pool.used++;
+
+    return block;
+}
+
+void poolFree(void *ptr, size_t size) {
+    if (ptr == nullptr) return;
+
+    unsigned int index = poolIndex(size);
+
+    if (index == POOL_COUNT) {
+        operator delete(ptr);
+        return;
+    }
+
+    struct pool &pool = pools[index];
+
+    *static_cast<void **>(ptr) = pool.freeBlocks;
+    pool.freeBlocks = ptr;
+    pool.used--;
+}
@@ -0,0 +1,33 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <cstddef>
+
+/**
+ * Small objects, like strings, variables and short lists, are allocated from pools of fixed size blocks. A pool carves
+ * its blocks from chunks of POOL_CHUNK_SIZE bytes, and keeps the freed ones in a list for the next allocation of the
+ * same size. This saves the header and the search of malloc, and as the blocks are never given back to the heap, the
+ * small objects don't fragment it. Larger objects fall back to the global operator new.
+ */
+#define POOL_COUNT 4            // Blocks of 8, 16, 32 and 64 bytes
+#define POOL_MIN_BLOCK_SIZE 8
+#define POOL_CHUNK_SIZE 512
+
+struct pool {
+    void *freeBlocks;           // Every free block starts with a pointer to the next one
+    unsigned int used;
+    unsigned int capacity;
+};
+
+extern struct pool pools[POOL_COUNT];
+
+void *poolAlloc(size_t size);
+
+void poolFree(void *ptr, size_t size);
+
+// Allocates all objects of a class from the pools
+#define POOL_ALLOCATED \
+    static void *operator new(size_t size) { return poolAlloc(size); } \
+    static void operator delete(void *ptr, size_t size) { poolFree(ptr, size); }
+
+#endif
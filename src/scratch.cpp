@@ -0,0 +1,67 @@
+#include "scratch.h"
+#include "pool.h"
+#include "stats.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#define SCRATCH_ALIGN alignof(std::max_align_t)
+
+static uint8_t *arena;
+static uint8_t *top;
+static unsigned int liveBlocks;
+
+/**
+ * Creates the arena, which is done when the program starts to run. Everything that is allocated before, like the OS
+ * variables, lives as long as the program anyway.
+ */
+void scratchInit() {
+    if (arena == nullptr) arena = top = static_cast<uint8_t *>(operator new(SCRATCH_SIZE));
+}
+
+void *scratchAlloc(size_t size) {
+    // Keep the blocks aligned, for hosts that need it
+    size_t blockSize = (size + SCRATCH_ALIGN - 1) & ~(SCRATCH_ALIGN - 1);
+
+    if (arena == nullptr || blockSize > (size_t) (arena + SCRATCH_SIZE - top)) {
+        return poolAlloc(size);
+    }
+
+    void *block = top;
+
+    top += blockSize;
+    liveBlocks++;
+    STATS_MAX(scratchPeak, (unsigned int) (top - arena));
+
+    return block;
+}
+
+void scratchFree(void *ptr, size_t size) {
+    if (!inScratch(ptr)) {
+        poolFree(ptr, size);
+        return;
+    }
+
+    if (!--liveBlocks) {
+        top = arena;
+        STATS_COUNT(scratchResets, 1);
+    }
+}
+
+bool inScratch(const void *ptr) {
+    return arena != nullptr && ptr >= arena && ptr < arena + SCRATCH_SIZE;
+}
+
+/**
+ * Ends a statement: all of its temporaries should be dead by now. If one escaped without being promoted it may still be
+ * in use, so the arena is left alone, and is only reset once the last block is freed.
+ */
+void scratchReset() {
+    if (liveBlocks) {
+        STATS_COUNT(scratchEscapes, 1);
+        return;
+    }
+
+    top = arena;
+}
@@ -0,0 +1,29 @@
+#ifndef SCRATCH_H
+#define SCRATCH_H
+
+#include <cstddef>
+
+/**
+ * The temporaries of a statement, like the intermediate lists of an expression, are allocated from the scratch arena
+ * by bumping a pointer. Blocks in it are never freed one by one: the arena only counts how many are still alive, and
+ * when the last one dies the whole arena is reset at once. Values which outlive their statement, like the ones stored
+ * in variables, must be moved out of it with Value::promote(). scratchReset() is called at the end of a statement to
+ * check that this happened: the bytecode VM calls it after every expression statement, but not after commands or
+ * control statements, and the tree walker before every statement. A block that escaped keeps the arena pinned until
+ * it's freed. If the arena is full or doesn't exist yet, the blocks come from the pools instead.
+ *
+ * The arena fits a list of the maximum length of 999 elements, plus some smaller temporaries.
+ */
+#define SCRATCH_SIZE 5120
+
+void scratchInit();
+
+void *scratchAlloc(size_t size);
+
+void scratchFree(void *ptr, size_t size);
+
+bool inScratch(const void *ptr);
+
+void scratchReset();
+
+#endif
@@ -0,0 +1,115 @@
+#include "stats.h"
+
+#ifdef SHOW_STATS
+
+#include "ast.h"
+#include "errors.h"
+#include "pool.h"
+#include "types.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fontlibc.h>
+#include <new>
+
+struct stats_t stats;
+
+// Replace the global allocation functions to count every heap allocation
+void *operator new(size_t size) {
+    void *ptr = malloc(size);
+
+    if (ptr == nullptr) memoryError();
+    stats.allocations++;
+
+    return ptr;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept {
+    if (ptr != nullptr) stats.frees++;
+
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    operator delete(ptr);
+}
+
+void operator delete(void *ptr, __attribute__((unused)) size_t size) noexcept {
+    operator delete(ptr);
+}
+
+void operator delete[](void *ptr, __attribute__((unused)) size_t size) noexcept {
+    operator delete(ptr);
+}
+
+static void printStat(const char *name, unsigned long value) {
+    char buf[27];
+
+    fontlib_Newline();
+    sprintf(buf, "%-16s%10lu", name, value);
+    fontlib_DrawString(buf);
+}
+
+static unsigned long ticksToMs(clock_t ticks) {
+    // CLOCKS_PER_SEC is 32768 on the CE, so use 64 bits to not overflow after a few seconds
+    return (unsigned long) ((unsigned long long) ticks * 1000 / CLOCKS_PER_SEC);
+}
+
+static void printNodeStats() {
+    unsigned int liveNodes = nodeCount - 1 - freeNodeCount;
+    unsigned long literalBytes = 0;
+
+    for (unsigned int i = 1; i < nodeCount; i++) {
+        if (nodes[i].data.type == ET_NUMBER) literalBytes += sizeof(Number);
+        if (nodes[i].data.type == ET_COMPLEX) literalBytes += sizeof(Complex);
+    }
+
+    // Before the arena, every node was a separate allocation with 2 pointers, a type and a pointer operand, and every
+    // literal was allocated separately as well. This doesn't even count the overhead of the allocator itself.
+    unsigned long oldNodeBytes = (unsigned long) liveNodes * (3 * sizeof(void *) + sizeof(int)) + literalBytes;
+
+    printStat("AST nodes", liveNodes);
+    printStat("AST bytes", (unsigned long) nodeCount * sizeof(struct NODE));
+    printStat("AST bytes (old)", oldNodeBytes);
+    printStat("Folded nodes", stats.foldedNodes);
+    printStat("Real operators", stats.realOperators);
+    printStat("Fused exprs", stats.fusedExpressions);
+}
+
+// Shows how many blocks of each pool are in use, out of all blocks that were carved for it
+static void printPoolStats() {
+    char buf[27];
+
+    for (unsigned int i = 0; i < POOL_COUNT; i++) {
+        fontlib_Newline();
+        sprintf(buf, "Pool %-3u%10u/%-7u", POOL_MIN_BLOCK_SIZE << i, pools[i].used, pools[i].capacity);
+        fontlib_DrawString(buf);
+    }
+
+    printStat("Pool fallbacks", stats.poolFallbacks);
+    printStat("Scratch peak", stats.scratchPeak);
+    printStat("Scratch resets", stats.scratchResets);
+    printStat("Scratch escapes", stats.scratchEscapes);
+}
+
+void printStats() {
+    printStat("Parse (ms)", ticksToMs(stats.parseTime));
+    printStat("Compile (ms)", ticksToMs(stats.compileTime));
+    printStat("Run (ms)", ticksToMs(stats.runTime));
+    printStat("Parse allocs", stats.parseAllocations);
+    printStat("Compile allocs", stats.compileAllocations);
+    printStat("Run allocs", stats.runAllocations);
+    printStat("Total frees", stats.frees);
+    printStat("Reused temps", stats.reusedPayloads);
+    printStat("Deoptimized ops", stats.deoptimizations);
+    printStat("LU factorized", stats.luFactorizations);
+    printStat("LU reused", stats.luReuses);
+    printNodeStats();
+    printPoolStats();
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef STATS_H
+#define STATS_H
+
+// Build with "make CXXFLAGS+=-DSHOW_STATS" to print timings and counters after the program has finished. Without it,
+// all of this compiles to nothing.
+#ifdef SHOW_STATS
+
+#include <ctime>
+
+struct stats_t {
+    unsigned long allocations;
+    unsigned long frees;
+
+    clock_t parseStart;
+    clock_t parseTime;
+    unsigned long parseAllocations;
+    clock_t compileStart;
+    clock_t compileTime;
+    unsigned long compileAllocations;
+    clock_t runStart;
+    clock_t runTime;
+    unsigned long runAllocations;
+    unsigned long reusedPayloads;
+    unsigned long poolFallbacks;
+    unsigned int scratchPeak;
+    unsigned long scratchResets;
+    unsigned long scratchEscapes;
+
+    unsigned int foldedNodes;
+    unsigned int realOperators;
+    unsigned int fusedExpressions;
+    unsigned long deoptimizations;
+    unsigned long luFactorizations;
+    unsigned long luReuses;
+};
+
+extern struct stats_t stats;
+
+// Measures both the time and the number of heap allocations of a phase
+#define STATS_START(name) (stats.name##Start = clock(), stats.name##Allocations -= stats.allocations)
+#define STATS_STOP(name) (stats.name##Time += clock() - stats.name##Start, stats.name##Allocations += stats.allocations)
+
+#define STATS_COUNT(name, amount) (stats.name += (amount))
+#define STATS_MAX(name, value) (stats.name < (value) ? (void) (stats.name = (value)) : (void) 0)
+
+void printStats();
+
+#else
+
+#define STATS_START(name) ((void) 0)
+#define STATS_STOP(name) ((void) 0)
+#define STATS_COUNT(name, amount) ((void) 0)
+#define STATS_MAX(name, value) ((void) 0)
+
+static inline void printStats() {}
+
+#endif
+
+#endif
@@ -0,0 +1,225 @@
+#include "trig.h"
+#include "errors.h"
+#include "globals.h"
+
+#include <cmath>
+#include <cstdint>
+
+// pi/2 split in two parts: the high part ends in enough zero bits that k * PIO2_HI is exact as long as |k| < 128
+#define PIO2_HI 1.5707855225f
+#define PIO2_LO 1.0804334124e-05f
+#define TWO_OVER_PI 0.63661977236f
+
+// Radians above this need more than 128 quarter turns, so they are left to the library, which reduces them properly
+#define REDUCE_LIMIT 200.0f
+
+#define DEG_TO_RAD 0.01745329252f
+#define RAD_TO_DEG 57.2957795131f
+
+// sin(45) and cos(45), correctly rounded
+#define SQRT1_2 0.70710678118f
+
+#ifdef FAST_TRIG
+
+#define TRIG_TABLE_SIZE 256
+
+// sin(i * pi/2 / TRIG_TABLE_SIZE), with one entry extra for rounding errors at pi/2. Filled on first use.
+static float sineTable[TRIG_TABLE_SIZE + 2];
+
+// Interpolates sin(x) for x in [0, pi/2]
+static float tableSin(float x) {
+    if (!sineTable[TRIG_TABLE_SIZE]) {
+        for (unsigned int i = 0; i < TRIG_TABLE_SIZE + 2; i++) {
+            sineTable[i] = sinf(i * (float) M_PI_2 / TRIG_TABLE_SIZE);
+        }
+    }
+
+    float position = x * (TRIG_TABLE_SIZE / (float) M_PI_2);
+    unsigned int index = (unsigned int) position;
+    float fraction = position - (float) index;
+
+    return sineTable[index] + (sineTable[index + 1] - sineTable[index]) * fraction;
+}
+
+static float sinKernel(float x) {
+    return x < 0 ? -tableSin(-x) : tableSin(x);
+}
+
+static float cosKernel(float x) {
+    if (x == 0) return 1;
+
+    return tableSin((float) M_PI_2 - fabsf(x));
+}
+
+#else
+
+// Minimax polynomials for |x| <= pi/4, which are accurate to about 1 ulp of a float
+static float sinKernel(float x) {
+    float z = x * x;
+
+    return x + x * z * (-1.66666666416e-1f + z * (8.33332938589e-3f +
+                                                   z * (-1.98393348361e-4f + z * 2.71831149399e-6f)));
+}
+
+static float cosKernel(float x) {
+    float z = x * x;
+
+    return 1 + z * (-4.99999997251e-1f + z * (4.16666233237e-2f + z * (-1.38867637746e-3f + z * 2.43904487963e-5f)));
+}
+
+#endif
+
+/**
+ * Subtracts the nearest multiple of a quarter turn from num, which leaves an angle of at most 1/8 turn. Degrees are
+ * reduced exactly, radians with an error of a few ulps. Returns the number of quarter turns modulo 4.
+ */
+static uint8_t reduce(float num, bool degrees, float &angle) {
+    if (degrees) {
+        // Both steps are exact: fmodf always is, and the turn is within a factor 2 of the multiple of 90 subtracted
+        float turn = fmodf(num, 360);
+        int quarters = (int) (turn * (1 / 90.0f) + (turn < 0 ? -0.5f : 0.5f));
+
+        angle = turn - (float) quarters * 90;
+        return (unsigned int) quarters & 3;
+    }
+
+    int quarters = (int) (num * TWO_OVER_PI + (num < 0 ? -0.5f : 0.5f));
+
+    angle = (num - (float) quarters * PIO2_HI) - (float) quarters * PIO2_LO;
+    return (unsigned int) quarters & 3;
+}
+
+static float sinReduced(float angle, bool degrees) {
+    if (degrees) {
+        // Just like the OS, sin(30)=.5 exactly, and with it cos(60), sin(150) etc.
+        if (angle == 30) return 0.5f;
+        if (angle == -30) return -0.5f;
+
+        // 45 degrees is reduced to either side of a quarter turn, so sin(45) could come from the cos polynomial and
+        // cos(45) from the sin one, which don't round the same
+        if (angle == 45) return SQRT1_2;
+        if (angle == -45) return -SQRT1_2;
+
+        angle *= DEG_TO_RAD;
+    }
+
+    return sinKernel(angle);
+}
+
+static float cosReduced(float angle, bool degrees) {
+    if (degrees) {
+        if (angle == 45 || angle == -45) return SQRT1_2;
+
+        angle *= DEG_TO_RAD;
+    }
+
+    return cosKernel(angle);
+}
+
+// The negations are written as 0 - x, so that sin(180) is 0 instead of -0
+
+static float sinAngle(float num, bool degrees) {
+    if (!degrees && fabsf(num) > REDUCE_LIMIT) return sinf(num);
+
+    float angle;
+
+    switch (reduce(num, degrees, angle)) {
+        case 0:
+            return sinReduced(angle, degrees);
+        case 1:
+            return cosReduced(angle, degrees);
+        case 2:
+            return 0 - sinReduced(angle, degrees);
+        default:
+            return 0 - cosReduced(angle, degrees);
+    }
+}
+
+static float cosAngle(float num, bool degrees) {
+    if (!degrees && fabsf(num) > REDUCE_LIMIT) return cosf(num);
+
+    float angle;
+
+    switch (reduce(num, degrees, angle)) {
+        case 0:
+            return cosReduced(angle, degrees);
+        case 1:
+            return 0 - sinReduced(angle, degrees);
+        case 2:
+            return 0 - cosReduced(angle, degrees);
+        default:
+            return sinReduced(angle, degrees);
+    }
+}
+
+static float tanAngle(float num, bool degrees) {
+    if (!degrees && fabsf(num) > REDUCE_LIMIT) return tanf(num);
+
+    float angle;
+    bool odd = reduce(num, degrees, angle) & 1;
+    float tangent;
+
+    if (degrees && (angle == 45 || angle == -45)) {
+        tangent = angle > 0 ? 1 : -1;
+    } else {
+        float sine = sinReduced(angle, degrees);
+        float cosine = cosReduced(angle, degrees);
+
+        // An odd number of quarter turns swaps sin and cos, so tan(x) = -cos(angle) / sin(angle)
+        if (!odd) return sine / cosine;
+
+        // The sine is only 0 here for an odd multiple of 90 degrees
+        if (sine == 0) domainError();
+
+        return 0 - cosine / sine;
+    }
+
+    return odd ? -tangent : tangent;
+}
+
+float sinfMode(float num) {
+    return sinAngle(num, !globals.inRadianMode);
+}
+
+float cosfMode(float num) {
+    return cosAngle(num, !globals.inRadianMode);
+}
+
+float tanfMode(float num) {
+    return tanAngle(num, !globals.inRadianMode);
+}
+
+float atanfMode(float num) {
+    if (globals.inRadianMode) {
+        return atanf(num);
+    }
+
+    if (num == 1) return 45;
+    if (num == -1) return -45;
+
+    return atanf(num) * RAD_TO_DEG;
+}
+
+void sinfModeList(float *out, const float *in, unsigned int length) {
+    bool degrees = !globals.inRadianMode;
+
+    for (unsigned int i = 0; i < length; i++) {
+        out[i] = sinAngle(in[i], degrees);
+    }
+}
+
+void cosfModeList(float *out, const float *in, unsigned int length) {
+    bool degrees = !globals.inRadianMode;
+
+    for (unsigned int i = 0; i < length; i++) {
+        out[i] = cosAngle(in[i], degrees);
+    }
+}
+
+void tanfModeList(float *out, const float *in, unsigned int length) {
+    bool degrees = !globals.inRadianMode;
+
+    for (unsigned int i = 0; i < length; i++) {
+        out[i] = tanAngle(in[i], degrees);
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef TRIG_H
+#define TRIG_H
+
+/**
+ * The trig functions take their angle in the current angle mode, and atanfMode returns one. Degrees are reduced
+ * exactly, so multiples of 30 and 45 degrees give the same exact values as the OS does, like sin(30)=.5.
+ *
+ * Building with -DFAST_TRIG evaluates sin, cos and tan by interpolating in a table instead, which is faster, but only
+ * accurate to about 5 digits. That is plenty for drawing, but not for displaying the results.
+ */
+
+float sinfMode(float num);
+
+float cosfMode(float num);
+
+float tanfMode(float num);
+
+float atanfMode(float num);
+
+// Apply the trig function to length elements of in, with the angle mode looked up only once
+void sinfModeList(float *out, const float *in, unsigned int length);
+
+void cosfModeList(float *out, const float *in, unsigned int length);
+
+void tanfModeList(float *out, const float *in, unsigned int length);
+
+#endif
@@ -1,39 +1,64 @@
 #include "types.h"
 #include "errors.h"
+#include "format.h"
 #include "functions.h"
-#include "utils.h"
+#include "main.h"
+#include "stats.h"
 
+#include <cmath>
 #include <cstring>
-#include <TINYSTL/vector.h>
-
-using tinystl::vector;
-
-char *BaseType::toString() const {
-    typeError();
-}
-
-char *Number::toString() const {
-    return formatNum(num);
-}
+#include <fileioc.h>
 
 Number::Number(float num) {
     this->num = num;
 }
 
-TypeType Number::type() {
-    return TypeType::NUMBER;
+/**
+ * Creates an integer. If it's too large to be used by the integer operators, it's only stored as float.
+ * @param num Integer to store
+ * @return The number
+ */
+Number Number::fromInt(int num) {
+    Number result((float) num);
+
+    if (num >= -INT_NUMBER_LIMIT && num <= INT_NUMBER_LIMIT) {
+        result.isInt = true;
+        result.intNum = num;
+    }
+
+    return result;
 }
 
-BaseType *Number::eval(UnaryOperator &op) {
-    return op.eval(*this);
+// The result of a comparison, which avoids converting the int to a float
+Number Number::fromBool(bool value) {
+    Number result(value ? 1.0f : 0.0f);
+
+    result.isInt = true;
+    result.intNum = value;
+
+    return result;
 }
 
-BaseType *Number::eval(BinaryOperator &op, BaseType *rhs) {
-    return op.eval(*this, *rhs);
+/**
+ * Creates a number, and checks whether it's a small integer. Use this for numbers which are created once but used
+ * often, like literals and variables from the OS.
+ * @param num Number to store
+ * @return The number
+ */
+Number Number::exact(float num) {
+    Number result(num);
+    float absNum = fabsf(num);
+
+    if (num == 0 || (absNum <= INT_NUMBER_LIMIT && is_pos_int(absNum))) {
+        result.isInt = true;
+        result.intNum = (int) num;
+    }
+
+    return result;
 }
 
-BaseType *Number::eval(UnaryFunction &func) {
-    return func.eval(*this);
+char *Number::toString() const {
+    return formatNum(num);
 }
 
 Complex::Complex(float real, float imag) {
@@ -41,14 +66,12 @@ Complex::Complex(float real, float imag) {
     this->imag = imag;
 }
 
-TypeType Complex::type() {
-    return TypeType::COMPLEX;
-}
-
 char *Complex::toString() const {
-    static char buf[25];
+    static char buf[2 * FORMAT_NUM_SIZE + 1];
     char *numBuf;
 
+    *buf = '\0';
+
     if (real != 0) {
         numBuf = formatNum(real);
         strcpy(buf, numBuf);
@@ -76,83 +99,113 @@ char *Complex::toString() const {
     return buf;
 }
 
-BaseType *Complex::eval(UnaryOperator &op) {
-    return op.eval(*this);
-}
+List *List::create(unsigned int length) {
+    auto list = static_cast<List *>(scratchAlloc(sizeof(List) + length * sizeof(float)));
 
-BaseType *Complex::eval(BinaryOperator &op, BaseType *rhs) {
-    return op.eval(*this, *rhs);
-}
+    list->refCount = 1;
+    list->length = list->capacity = length;
 
-BaseType *Complex::eval(UnaryFunction &func) {
-    return func.eval(*this);
+    return list;
 }
 
-List::List(vector<Number> &elements) {
-    this->elements = elements;
+/**
+ * Gets a list to store the result of an element-wise operation in. If the operand is only owned by the value which the
+ * result replaces, it's overwritten in place, otherwise a new list of the same length is created.
+ */
+List *List::createResult(List &operand) {
+    if (operand.refCount == 1) {
+        STATS_COUNT(reusedPayloads, 1);
+        return retain(&operand);
+    }
+
+    return create(operand.length);
 }
 
-List::~List() {
-    elements.clear();
+// Both operands should have the same length
+List *List::createResult(List &lhs, List &rhs) {
+    return lhs.refCount == 1 ? createResult(lhs) : createResult(rhs);
 }
 
-TypeType List::type() {
-    return TypeType::LIST;
+List *List::copy() const {
+    List *list = create(length);
+
+    memcpy(list->elements, elements, length * sizeof(float));
+
+    return list;
 }
 
 char *List::toString() const {
-    if (elements.empty()) dimensionError();
+    if (!length) dimensionError();
 
-    static char buf[40] = "{";
+    // The elements are formatted in place, until they no longer fit on the line
+    static char buf[27 + FORMAT_NUM_SIZE];
+    char *end = buf;
 
-    for (const auto &number: elements) {
-        strcat(buf, number.toString());
-        strcat(buf, " ");
+    *end++ = '{';
 
-        if (strlen(buf) > 26) break;
+    for (unsigned int i = 0; i < length; i++) {
+        end = formatNumInto(end, elements[i]);
+        *end++ = ' ';
+
+        if (end - buf > 26) break;
     }
 
-    if (strlen(buf) > 25) {
+    if (end - buf > 25) {
         buf[25] = 0xCE;
+        buf[26] = '\0';
     } else {
         // Overwrite space with closing bracket
-        buf[strlen(buf) - 1] = '}';
+        end[-1] = '}';
+        *end = '\0';
     }
 
     return buf;
 }
 
-BaseType *List::eval(UnaryOperator &op) {
-    return op.eval(*this);
-}
+ComplexList *ComplexList::create(unsigned int length) {
+    auto list = static_cast<ComplexList *>(scratchAlloc(sizeof(ComplexList) + length * 2 * sizeof(float)));
+
+    list->refCount = 1;
+    list->length = list->capacity = length;
 
-BaseType *List::eval(BinaryOperator &op, BaseType *rhs) {
-    return op.eval(*this, *rhs);
+    return list;
 }
 
-BaseType *List::eval(UnaryFunction &func) {
-    return func.eval(*this);
+ComplexList *ComplexList::createResult(ComplexList &operand) {
+    if (operand.refCount == 1) {
+        STATS_COUNT(reusedPayloads, 1);
+        return retain(&operand);
+    }
+
+    return create(operand.length);
 }
 
-ComplexList::ComplexList(const vector<Complex> &elements) {
-    this->elements = elements;
+ComplexList *ComplexList::copy() const {
+    ComplexList *list = create(length);
+
+    memcpy(list->elements, elements, length * 2 * sizeof(float));
+
+    return list;
 }
 
-ComplexList::~ComplexList() {
-    elements.clear();
+Complex ComplexList::at(unsigned int index) const {
+    return Complex(elements[2 * index], elements[2 * index + 1]);
 }
 
-TypeType ComplexList::type() {
-    return TypeType::COMPLEX_LIST;
+void ComplexList::set(unsigned int index, const Complex &cplx) {
+    elements[2 * index] = cplx.real;
+    elements[2 * index + 1] = cplx.imag;
 }
 
 char *ComplexList::toString() const {
-    if (elements.empty()) dimensionError();
+    if (!length) dimensionError();
+
+    static char buf[27 + 2 * FORMAT_NUM_SIZE];
 
-    static char buf[50] = "{";
+    strcpy(buf, "{");
 
-    for (const auto &number: elements) {
-        strcat(buf, number.toString());
+    for (unsigned int i = 0; i < length; i++) {
+        strcat(buf, at(i).toString());
         strcat(buf, " ");
 
         if (strlen(buf) > 26) break;
@@ -160,6 +213,7 @@ char *ComplexList::toString() const {
 
     if (strlen(buf) > 25) {
         buf[25] = 0xCE;
+        buf[26] = '\0';
     } else {
         // Overwrite space with closing bracket
         buf[strlen(buf) - 1] = '}';
@@ -168,29 +222,31 @@ char *ComplexList::toString() const {
     return buf;
 }
 
-BaseType *ComplexList::eval(UnaryOperator &op) {
-    return op.eval(*this);
+String::String(unsigned int length, char *string) {
+    this->length = length;
+    this->string = string;
 }
 
-BaseType *ComplexList::eval(BinaryOperator &op, BaseType *rhs) {
-    return op.eval(*this, *rhs);
+String::~String() {
+    scratchFree(string, length);
 }
 
-BaseType *ComplexList::eval(UnaryFunction &func) {
-    return func.eval(*this);
+char *String::allocate(unsigned int length) {
+    return static_cast<char *>(scratchAlloc(length));
 }
 
-String::String(unsigned int length, char *string) {
-    this->length = length;
-    this->string = string;
-}
+String *String::copy() const {
+    auto data = allocate(length);
 
-String::~String() {
-    delete string;
+    memcpy(data, string, length);
+
+    return new String(length, data);
 }
 
 char *String::toString() const {
-    static char buf[35] = "";
+    static char buf[35];
+
+    *buf = '\0';
 
     void *readLocation = string;
     unsigned int totalLength = 0;
@@ -208,465 +264,738 @@ char *String::toString() const {
     return buf;
 }
 
-TypeType String::type() {
-    return TypeType::STRING;
+Matrix *Matrix::create(uint8_t rows, uint8_t cols) {
+    auto matrix = static_cast<Matrix *>(scratchAlloc(sizeof(Matrix) + rows * cols * sizeof(float)));
+
+    matrix->refCount = 1;
+    matrix->rows = rows;
+    matrix->cols = cols;
+
+    return matrix;
 }
 
-BaseType *String::eval(UnaryOperator &op) {
-    return op.eval(*this);
+Matrix *Matrix::createResult(Matrix &operand) {
+    if (operand.refCount == 1) {
+        STATS_COUNT(reusedPayloads, 1);
+        return retain(&operand);
+    }
+
+    return create(operand.rows, operand.cols);
 }
 
-BaseType *String::eval(BinaryOperator &op, BaseType *rhs) {
-    return op.eval(*this, *rhs);
+// Both operands should have the same dimensions
+Matrix *Matrix::createResult(Matrix &lhs, Matrix &rhs) {
+    return lhs.refCount == 1 ? createResult(lhs) : createResult(rhs);
 }
 
-BaseType *String::eval(UnaryFunction &func) {
-    return func.eval(*this);
+Matrix *Matrix::copy() const {
+    Matrix *matrix = create(rows, cols);
+
+    memcpy(matrix->elements, elements, size() * sizeof(float));
+
+    return matrix;
 }
 
-Matrix::Matrix(vector<vector<Number>> &elements) {
-    this->elements = elements;
+unsigned int Matrix::size() const {
+    return rows * cols;
 }
 
-Matrix::~Matrix() {
-    elements.clear();
+float &Matrix::at(uint8_t row, uint8_t col) {
+    return elements[row * cols + col];
 }
 
-char *Matrix::toString() const {
-    // Matrix to string depends on the context: when using Disp, it is displayed as a real 2D matrix. When using
-    // Output(, it is converted to a string without spaces. Don't convert it here, but at the place where it's
-    // necessary.
-    typeError();
+float Matrix::at(uint8_t row, uint8_t col) const {
+    return elements[row * cols + col];
+}
+
+Value::Value() {
+    type = TypeType::NONE;
+}
+
+Value::Value(Number number) {
+    type = TypeType::NUMBER;
+    this->number = number;
+}
+
+Value::Value(Complex complex) {
+    type = TypeType::COMPLEX;
+    this->complex = complex;
+}
+
+Value::Value(List *list) {
+    type = TypeType::LIST;
+    this->list = list;
+}
+
+Value::Value(ComplexList *complexList) {
+    type = TypeType::COMPLEX_LIST;
+    this->complexList = complexList;
+}
+
+Value::Value(String *string) {
+    type = TypeType::STRING;
+    this->string = string;
+}
+
+Value::Value(Matrix *matrix) {
+    type = TypeType::MATRIX;
+    this->matrix = matrix;
+}
+
+void Value::releasePayload() {
+    switch (type) {
+        case TypeType::LIST:
+            release(list);
+            break;
+        case TypeType::COMPLEX_LIST:
+            release(complexList);
+            break;
+        case TypeType::STRING:
+            release(string);
+            break;
+        case TypeType::MATRIX:
+            release(matrix);
+            break;
+        default:
+            break;
+    }
+}
+
+char *Value::toString() const {
+    switch (type) {
+        case TypeType::NUMBER:
+            return number.toString();
+        case TypeType::COMPLEX:
+            return complex.toString();
+        case TypeType::LIST:
+            return list->toString();
+        case TypeType::COMPLEX_LIST:
+            return complexList->toString();
+        case TypeType::STRING:
+            return string->toString();
+        default:
+            // Matrix to string depends on the context: when using Disp, it is displayed as a real 2D matrix. When using
+            // Output(, it is converted to a string without spaces. Don't convert it here, but at the place where it's
+            // necessary.
+            typeError();
+    }
+}
+
+Number &Value::asNumber() {
+    if (type != TypeType::NUMBER) typeError();
+
+    return number;
+}
+
+Complex &Value::asComplex() {
+    if (type != TypeType::COMPLEX) typeError();
+
+    return complex;
 }
 
-TypeType Matrix::type() {
-    return TypeType::MATRIX;
+void Value::makeUnique() {
+    switch (type) {
+        case TypeType::LIST:
+            if (list->refCount > 1) {
+                List *unique = list->copy();
+                release(list);
+                list = unique;
+            }
+            break;
+        case TypeType::COMPLEX_LIST:
+            if (complexList->refCount > 1) {
+                ComplexList *unique = complexList->copy();
+                release(complexList);
+                complexList = unique;
+            }
+            break;
+        case TypeType::STRING:
+            if (string->refCount > 1) {
+                String *unique = string->copy();
+                release(string);
+                string = unique;
+            }
+            break;
+        case TypeType::MATRIX:
+            if (matrix->refCount > 1) {
+                Matrix *unique = matrix->copy();
+                release(matrix);
+                matrix = unique;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Returns another owner of the same value, so reading a variable never copies its list or matrix
+ */
+Value Value::share() const {
+    switch (type) {
+        case TypeType::NUMBER:
+            return number;
+        case TypeType::COMPLEX:
+            return complex;
+        case TypeType::LIST:
+            return retain(list);
+        case TypeType::COMPLEX_LIST:
+            return retain(complexList);
+        case TypeType::STRING:
+            return retain(string);
+        case TypeType::MATRIX:
+            return retain(matrix);
+        default:
+            return Value();
+    }
+}
+
+// Copies a payload from the scratch arena into its own block, with this value as its only owner
+template<typename T>
+static T *promotePayload(T *payload, size_t size) {
+    if (!inScratch(payload)) return payload;
+
+    auto promoted = static_cast<T *>(poolAlloc(size));
+
+    memcpy(promoted, payload, size);
+    promoted->refCount = 1;
+    release(payload);
+
+    return promoted;
+}
+
+/**
+ * Moves the payload out of the scratch arena, for values which outlive the statement that created them, like the value
+ * of a variable. Otherwise the arena can't be reset as long as they exist.
+ */
+void Value::promote() {
+    switch (type) {
+        case TypeType::LIST:
+            list = promotePayload(list, sizeof(List) + list->capacity * sizeof(float));
+            break;
+        case TypeType::COMPLEX_LIST:
+            complexList = promotePayload(complexList, sizeof(ComplexList) + complexList->capacity * 2 * sizeof(float));
+            break;
+        case TypeType::STRING:
+            if (inScratch(string->string)) {
+                char *characters = static_cast<char *>(poolAlloc(string->length));
+
+                memcpy(characters, string->string, string->length);
+                scratchFree(string->string, string->length);
+                string->string = characters;
+            }
+            break;
+        case TypeType::MATRIX:
+            matrix = promotePayload(matrix, sizeof(Matrix) + matrix->size() * sizeof(float));
+            break;
+        default:
+            break;
+    }
 }
 
-BaseType *Matrix::eval(UnaryOperator &op) {
-    return op.eval(*this);
+Value Value::eval(UnaryOperator &op) {
+    switch (type) {
+        case TypeType::NUMBER:
+            return op.eval(number);
+        case TypeType::COMPLEX:
+            return op.eval(complex);
+        case TypeType::LIST:
+            return op.eval(*list);
+        case TypeType::COMPLEX_LIST:
+            return op.eval(*complexList);
+        case TypeType::STRING:
+            return op.eval(*string);
+        case TypeType::MATRIX:
+            return op.eval(*matrix);
+        default:
+            typeError();
+    }
 }
 
-BaseType *Matrix::eval(BinaryOperator &op, BaseType *rhs) {
-    return op.eval(*this, *rhs);
+Value Value::eval(BinaryOperator &op, Value &rhs) {
+    switch (type) {
+        case TypeType::NUMBER:
+            return op.eval(number, rhs);
+        case TypeType::COMPLEX:
+            return op.eval(complex, rhs);
+        case TypeType::LIST:
+            return op.eval(*list, rhs);
+        case TypeType::COMPLEX_LIST:
+            return op.eval(*complexList, rhs);
+        case TypeType::STRING:
+            return op.eval(*string, rhs);
+        case TypeType::MATRIX:
+            return op.eval(*matrix, rhs);
+        default:
+            typeError();
+    }
 }
 
-BaseType *Matrix::eval(UnaryFunction &func) {
-    return func.eval(*this);
+Value Value::eval(UnaryFunction &func) {
+    switch (type) {
+        case TypeType::NUMBER:
+            return func.eval(number);
+        case TypeType::COMPLEX:
+            return func.eval(complex);
+        case TypeType::LIST:
+            return func.eval(*list);
+        case TypeType::COMPLEX_LIST:
+            return func.eval(*complexList);
+        case TypeType::STRING:
+            return func.eval(*string);
+        case TypeType::MATRIX:
+            return func.eval(*matrix);
+        default:
+            typeError();
+    }
 }
 
-BaseType *UnaryOperator::eval(__attribute__((unused)) Number &rhs) {
+Value UnaryOperator::eval(__attribute__((unused)) Number &rhs) {
     typeError();
 }
 
-BaseType *UnaryOperator::eval(__attribute__((unused)) Complex &rhs) {
+Value UnaryOperator::eval(__attribute__((unused)) Complex &rhs) {
     typeError();
 }
 
-BaseType *UnaryOperator::eval(List &rhs) {
-    if (rhs.elements.empty()) dimensionError();
+Value UnaryOperator::eval(List &rhs) {
+    if (!rhs.length) dimensionError();
+
+    List *result = List::create(rhs.length);
 
-    auto newElements = rhs.elements;
+    for (unsigned int i = 0; i < rhs.length; i++) {
+        Number element(rhs.elements[i]);
 
-    for (auto &number : newElements) {
-        number = dynamic_cast<Number &>(*this->eval(number));
+        result->elements[i] = this->eval(element).asNumber().num;
     }
 
-    return new List(newElements);
+    return result;
 }
 
-BaseType *UnaryOperator::eval(ComplexList &rhs) {
-    if (rhs.elements.empty()) dimensionError();
+Value UnaryOperator::eval(ComplexList &rhs) {
+    if (!rhs.length) dimensionError();
 
-    auto newElements = rhs.elements;
+    ComplexList *result = ComplexList::create(rhs.length);
 
-    for (auto &cplx : newElements) {
-        cplx = dynamic_cast<Complex &>(*this->eval(cplx));
+    for (unsigned int i = 0; i < rhs.length; i++) {
+        Complex element = rhs.at(i);
+
+        result->set(i, this->eval(element).asComplex());
     }
 
-    return new ComplexList(newElements);
+    return result;
 }
 
-BaseType *UnaryOperator::eval(__attribute__((unused)) String &rhs) {
+Value UnaryOperator::eval(__attribute__((unused)) String &rhs) {
     typeError();
 }
 
-BaseType *UnaryOperator::eval(__attribute__((unused)) Matrix &rhs) {
+Value UnaryOperator::eval(__attribute__((unused)) Matrix &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(Number &lhs, BaseType &rhs) {
-    switch (rhs.type()) {
+Value BinaryOperator::eval(Number &lhs, Value &rhs) {
+    switch (rhs.type) {
         case TypeType::NUMBER:
-            return this->eval(lhs, dynamic_cast<Number &>(rhs));
+            return this->eval(lhs, rhs.number);
         case TypeType::COMPLEX:
-            return this->eval(lhs, dynamic_cast<Complex &>(rhs));
+            return this->eval(lhs, rhs.complex);
         case TypeType::LIST:
-            return this->eval(lhs, dynamic_cast<List &>(rhs));
+            return this->eval(lhs, *rhs.list);
         case TypeType::COMPLEX_LIST:
-            return this->eval(lhs, dynamic_cast<ComplexList &>(rhs));
+            return this->eval(lhs, *rhs.complexList);
         case TypeType::STRING:
-            return this->eval(lhs, dynamic_cast<String &>(rhs));
+            return this->eval(lhs, *rhs.string);
         case TypeType::MATRIX:
-            return this->eval(lhs, dynamic_cast<Matrix &>(rhs));
+            return this->eval(lhs, *rhs.matrix);
+        default:
+            typeError();
     }
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) Number &lhs, __attribute__((unused)) Number &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) Number &lhs, __attribute__((unused)) Number &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) Number &lhs, __attribute__((unused)) Complex &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) Number &lhs, __attribute__((unused)) Complex &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(Number &lhs, List &rhs) {
-    if (rhs.elements.empty()) dimensionError();
+Value BinaryOperator::eval(Number &lhs, List &rhs) {
+    if (!rhs.length) dimensionError();
+
+    List *result = List::create(rhs.length);
 
-    auto newElements = rhs.elements;
+    for (unsigned int i = 0; i < rhs.length; i++) {
+        Number element(rhs.elements[i]);
 
-    for (auto &number : newElements) {
-        number = dynamic_cast<Number &>(*this->eval(lhs, number));
+        result->elements[i] = this->eval(lhs, element).asNumber().num;
     }
 
-    return new List(newElements);
+    return result;
 }
 
-BaseType *BinaryOperator::eval(Number &lhs, ComplexList &rhs) {
-    if (rhs.elements.empty()) dimensionError();
+Value BinaryOperator::eval(Number &lhs, ComplexList &rhs) {
+    if (!rhs.length) dimensionError();
 
-    auto newElements = rhs.elements;
+    ComplexList *result = ComplexList::create(rhs.length);
 
-    for (auto &cplx : newElements) {
-        cplx = dynamic_cast<Complex &>(*this->eval(lhs, cplx));
+    for (unsigned int i = 0; i < rhs.length; i++) {
+        Complex element = rhs.at(i);
+
+        result->set(i, this->eval(lhs, element).asComplex());
     }
 
-    return new ComplexList(newElements);
+    return result;
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) Number &lhs, __attribute__((unused)) String &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) Number &lhs, __attribute__((unused)) String &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(Number &lhs, Matrix &rhs) {
-    if (rhs.elements.empty()) dimensionError();
+Value BinaryOperator::eval(Number &lhs, Matrix &rhs) {
+    if (!rhs.size()) dimensionError();
 
-    auto newElements = rhs.elements;
+    Matrix *result = Matrix::create(rhs.rows, rhs.cols);
 
-    for (auto &row : newElements) {
-        for (auto &col : row) {
-            col = dynamic_cast<Number &>(*this->eval(lhs, col));
-        }
+    for (unsigned int i = 0; i < rhs.size(); i++) {
+        Number element(rhs.elements[i]);
+
+        result->elements[i] = this->eval(lhs, element).asNumber().num;
     }
 
-    return new Matrix(newElements);
+    return result;
 }
 
-BaseType *BinaryOperator::eval(Complex &lhs, BaseType &rhs) {
-    switch (rhs.type()) {
+Value BinaryOperator::eval(Complex &lhs, Value &rhs) {
+    switch (rhs.type) {
         case TypeType::NUMBER:
-            return this->eval(lhs, dynamic_cast<Number &>(rhs));
+            return this->eval(lhs, rhs.number);
         case TypeType::COMPLEX:
-            return this->eval(lhs, dynamic_cast<Complex &>(rhs));
+            return this->eval(lhs, rhs.complex);
         case TypeType::LIST:
-            return this->eval(lhs, dynamic_cast<List &>(rhs));
+            return this->eval(lhs, *rhs.list);
         case TypeType::COMPLEX_LIST:
-            return this->eval(lhs, dynamic_cast<ComplexList &>(rhs));
+            return this->eval(lhs, *rhs.complexList);
         case TypeType::STRING:
-            return this->eval(lhs, dynamic_cast<String &>(rhs));
+            return this->eval(lhs, *rhs.string);
         case TypeType::MATRIX:
-            return this->eval(lhs, dynamic_cast<Matrix &>(rhs));
+            return this->eval(lhs, *rhs.matrix);
+        default:
+            typeError();
     }
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused))Complex &lhs, __attribute__((unused))Number &rhs) {
+Value BinaryOperator::eval(__attribute__((unused))Complex &lhs, __attribute__((unused))Number &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) Complex &lhs, __attribute__((unused)) Complex &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) Complex &lhs, __attribute__((unused)) Complex &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(Complex &lhs, List &rhs) {
-    if (rhs.elements.empty()) dimensionError();
+Value BinaryOperator::eval(Complex &lhs, List &rhs) {
+    if (!rhs.length) dimensionError();
 
-    auto newElements = vector<Complex>(rhs.elements.size());
+    ComplexList *result = ComplexList::create(rhs.length);
 
-    unsigned int index = 0;
-    for (auto &number : rhs.elements) {
-        newElements[index++] = dynamic_cast<Complex &>(*this->eval(lhs, number));
+    for (unsigned int i = 0; i < rhs.length; i++) {
+        Number element(rhs.elements[i]);
+
+        result->set(i, this->eval(lhs, element).asComplex());
     }
 
-    return new ComplexList(newElements);
+    return result;
 }
 
-BaseType *BinaryOperator::eval(Complex &lhs, ComplexList &rhs) {
-    if (rhs.elements.empty()) dimensionError();
+Value BinaryOperator::eval(Complex &lhs, ComplexList &rhs) {
+    if (!rhs.length) dimensionError();
+
+    ComplexList *result = ComplexList::create(rhs.length);
 
-    auto newElements = rhs.elements;
+    for (unsigned int i = 0; i < rhs.length; i++) {
+        Complex element = rhs.at(i);
 
-    for (auto &cplx : newElements) {
-        cplx = dynamic_cast<Complex &>(*this->eval(lhs, cplx));
+        result->set(i, this->eval(lhs, element).asComplex());
     }
 
-    return new ComplexList(newElements);
+    return result;
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) Complex &lhs, __attribute__((unused)) String &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) Complex &lhs, __attribute__((unused)) String &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) Complex &lhs, __attribute__((unused)) Matrix &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) Complex &lhs, __attribute__((unused)) Matrix &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(List &lhs, BaseType &rhs) {
-    switch (rhs.type()) {
+Value BinaryOperator::eval(List &lhs, Value &rhs) {
+    switch (rhs.type) {
         case TypeType::NUMBER:
-            return this->eval(lhs, dynamic_cast<Number &>(rhs));
+            return this->eval(lhs, rhs.number);
         case TypeType::COMPLEX:
-            return this->eval(lhs, dynamic_cast<Complex &>(rhs));
+            return this->eval(lhs, rhs.complex);
         case TypeType::LIST:
-            return this->eval(lhs, dynamic_cast<List &>(rhs));
+            return this->eval(lhs, *rhs.list);
         case TypeType::COMPLEX_LIST:
-            return this->eval(lhs, dynamic_cast<ComplexList &>(rhs));
+            return this->eval(lhs, *rhs.complexList);
         case TypeType::STRING:
-            return this->eval(lhs, dynamic_cast<String &>(rhs));
+            return this->eval(lhs, *rhs.string);
         case TypeType::MATRIX:
-            return this->eval(lhs, dynamic_cast<Matrix &>(rhs));
+            return this->eval(lhs, *rhs.matrix);
+        default:
+            typeError();
     }
 }
 
-BaseType *BinaryOperator::eval(List &lhs, Number &rhs) {
-    if (lhs.elements.empty()) dimensionError();
+Value BinaryOperator::eval(List &lhs, Number &rhs) {
+    if (!lhs.length) dimensionError();
 
-    auto newElements = lhs.elements;
+    List *result = List::create(lhs.length);
 
-    for (auto &number : newElements) {
-        number = dynamic_cast<Number &>(*this->eval(number, rhs));
+    for (unsigned int i = 0; i < lhs.length; i++) {
+        Number element(lhs.elements[i]);
+
+        result->elements[i] = this->eval(element, rhs).asNumber().num;
     }
 
-    return new List(newElements);
+    return result;
 }
 
-BaseType *BinaryOperator::eval(List &lhs, Complex &rhs) {
-    if (lhs.elements.empty()) dimensionError();
+Value BinaryOperator::eval(List &lhs, Complex &rhs) {
+    if (!lhs.length) dimensionError();
+
+    ComplexList *result = ComplexList::create(lhs.length);
 
-    auto newElements = vector<Complex>(lhs.elements.size());
+    for (unsigned int i = 0; i < lhs.length; i++) {
+        Number element(lhs.elements[i]);
 
-    unsigned int index = 0;
-    for (auto &number : lhs.elements) {
-        newElements[index++] = dynamic_cast<Complex &>(*this->eval(number, rhs));
+        result->set(i, this->eval(element, rhs).asComplex());
     }
 
-    return new ComplexList(newElements);
+    return result;
 }
 
-BaseType *BinaryOperator::eval(List &lhs, List &rhs) {
-    if (lhs.elements.empty()) dimensionError();
-    if (lhs.elements.size() != rhs.elements.size()) dimensionMismatch();
+Value BinaryOperator::eval(List &lhs, List &rhs) {
+    if (!lhs.length) dimensionError();
+    if (lhs.length != rhs.length) dimensionMismatch();
+
+    List *result = List::create(lhs.length);
 
-    auto newElements = lhs.elements;
+    for (unsigned int i = 0; i < lhs.length; i++) {
+        Number lhsElement(lhs.elements[i]);
+        Number rhsElement(rhs.elements[i]);
 
-    unsigned int index = 0;
-    for (auto &number : newElements) {
-        number = dynamic_cast<Number &>(*this->eval(number, rhs.elements[index]));
-        index++;
+        result->elements[i] = this->eval(lhsElement, rhsElement).asNumber().num;
     }
 
-    return new List(newElements);
+    return result;
 }
 
-BaseType *BinaryOperator::eval(List &lhs, ComplexList &rhs) {
-    if (lhs.elements.empty()) dimensionError();
-    if (lhs.elements.size() != rhs.elements.size()) dimensionMismatch();
+Value BinaryOperator::eval(List &lhs, ComplexList &rhs) {
+    if (!lhs.length) dimensionError();
+    if (lhs.length != rhs.length) dimensionMismatch();
 
-    auto newElements = rhs.elements;
+    ComplexList *result = ComplexList::create(lhs.length);
 
-    unsigned int index = 0;
-    for (auto &cplx : newElements) {
-        cplx = dynamic_cast<Complex &>(*this->eval(lhs.elements[index], cplx));
-        index++;
+    for (unsigned int i = 0; i < lhs.length; i++) {
+        Number lhsElement(lhs.elements[i]);
+        Complex rhsElement = rhs.at(i);
+
+        result->set(i, this->eval(lhsElement, rhsElement).asComplex());
     }
 
-    return new ComplexList(newElements);
+    return result;
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) List &lhs, __attribute__((unused)) String &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) List &lhs, __attribute__((unused)) String &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) List &lhs, __attribute__((unused)) Matrix &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) List &lhs, __attribute__((unused)) Matrix &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(ComplexList &lhs, BaseType &rhs) {
-    switch (rhs.type()) {
+Value BinaryOperator::eval(ComplexList &lhs, Value &rhs) {
+    switch (rhs.type) {
         case TypeType::NUMBER:
-            return this->eval(lhs, dynamic_cast<Number &>(rhs));
+            return this->eval(lhs, rhs.number);
         case TypeType::COMPLEX:
-            return this->eval(lhs, dynamic_cast<Complex &>(rhs));
+            return this->eval(lhs, rhs.complex);
         case TypeType::LIST:
-            return this->eval(lhs, dynamic_cast<List &>(rhs));
+            return this->eval(lhs, *rhs.list);
         case TypeType::COMPLEX_LIST:
-            return this->eval(lhs, dynamic_cast<ComplexList &>(rhs));
+            return this->eval(lhs, *rhs.complexList);
         case TypeType::STRING:
-            return this->eval(lhs, dynamic_cast<String &>(rhs));
+            return this->eval(lhs, *rhs.string);
         case TypeType::MATRIX:
-            return this->eval(lhs, dynamic_cast<Matrix &>(rhs));
+            return this->eval(lhs, *rhs.matrix);
+        default:
+            typeError();
     }
 }
 
-BaseType *BinaryOperator::eval(ComplexList &lhs, Number &rhs) {
-    if (lhs.elements.empty()) dimensionError();
+Value BinaryOperator::eval(ComplexList &lhs, Number &rhs) {
+    if (!lhs.length) dimensionError();
+
+    ComplexList *result = ComplexList::create(lhs.length);
 
-    auto newElements = lhs.elements;
+    for (unsigned int i = 0; i < lhs.length; i++) {
+        Complex element = lhs.at(i);
 
-    for (auto &cplx : newElements) {
-        cplx = dynamic_cast<Complex &>(*this->eval(cplx, rhs));
+        result->set(i, this->eval(element, rhs).asComplex());
     }
 
-    return new ComplexList(newElements);
+    return result;
 }
 
-BaseType *BinaryOperator::eval(ComplexList &lhs, Complex &rhs) {
-    if (lhs.elements.empty()) dimensionError();
+Value BinaryOperator::eval(ComplexList &lhs, Complex &rhs) {
+    if (!lhs.length) dimensionError();
 
-    auto newElements = lhs.elements;
+    ComplexList *result = ComplexList::create(lhs.length);
 
-    for (auto &cplx : newElements) {
-        cplx = dynamic_cast<Complex &>(*this->eval(cplx, rhs));
+    for (unsigned int i = 0; i < lhs.length; i++) {
+        Complex element = lhs.at(i);
+
+        result->set(i, this->eval(element, rhs).asComplex());
     }
 
-    return new ComplexList(newElements);
+    return result;
 }
 
-BaseType *BinaryOperator::eval(ComplexList &lhs, List &rhs) {
-    if (lhs.elements.empty()) dimensionError();
-    if (lhs.elements.size() != rhs.elements.size()) dimensionMismatch();
+Value BinaryOperator::eval(ComplexList &lhs, List &rhs) {
+    if (!lhs.length) dimensionError();
+    if (lhs.length != rhs.length) dimensionMismatch();
+
+    ComplexList *result = ComplexList::create(lhs.length);
 
-    auto newElements = lhs.elements;
+    for (unsigned int i = 0; i < lhs.length; i++) {
+        Complex lhsElement = lhs.at(i);
+        Number rhsElement(rhs.elements[i]);
 
-    unsigned int index = 0;
-    for (auto &cplx : newElements) {
-        cplx = dynamic_cast<Complex &>(*this->eval(cplx, rhs.elements[index]));
-        index++;
+        result->set(i, this->eval(lhsElement, rhsElement).asComplex());
     }
 
-    return new ComplexList(newElements);
+    return result;
 }
 
-BaseType *BinaryOperator::eval(ComplexList &lhs, ComplexList &rhs) {
-    if (lhs.elements.empty()) dimensionError();
-    if (lhs.elements.size() != rhs.elements.size()) dimensionMismatch();
+Value BinaryOperator::eval(ComplexList &lhs, ComplexList &rhs) {
+    if (!lhs.length) dimensionError();
+    if (lhs.length != rhs.length) dimensionMismatch();
+
+    ComplexList *result = ComplexList::create(lhs.length);
 
-    auto newElements = lhs.elements;
+    for (unsigned int i = 0; i < lhs.length; i++) {
+        Complex lhsElement = lhs.at(i);
+        Complex rhsElement = rhs.at(i);
 
-    unsigned int index = 0;
-    for (auto &cplx : newElements) {
-        cplx = dynamic_cast<Complex &>(*this->eval(cplx, rhs.elements[index]));
-        index++;
+        result->set(i, this->eval(lhsElement, rhsElement).asComplex());
     }
 
-    return new ComplexList(newElements);
+    return result;
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) ComplexList &lhs, __attribute__((unused)) String &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) ComplexList &lhs, __attribute__((unused)) String &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) ComplexList &lhs, __attribute__((unused)) Matrix &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) ComplexList &lhs, __attribute__((unused)) Matrix &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(String &lhs, BaseType &rhs) {
-    switch (rhs.type()) {
+Value BinaryOperator::eval(String &lhs, Value &rhs) {
+    switch (rhs.type) {
         case TypeType::NUMBER:
-            return this->eval(lhs, dynamic_cast<Number &>(rhs));
+            return this->eval(lhs, rhs.number);
         case TypeType::COMPLEX:
-            return this->eval(lhs, dynamic_cast<Complex &>(rhs));
+            return this->eval(lhs, rhs.complex);
         case TypeType::LIST:
-            return this->eval(lhs, dynamic_cast<List &>(rhs));
+            return this->eval(lhs, *rhs.list);
         case TypeType::COMPLEX_LIST:
-            return this->eval(lhs, dynamic_cast<ComplexList &>(rhs));
+            return this->eval(lhs, *rhs.complexList);
         case TypeType::STRING:
-            return this->eval(lhs, dynamic_cast<String &>(rhs));
+            return this->eval(lhs, *rhs.string);
         case TypeType::MATRIX:
-            return this->eval(lhs, dynamic_cast<Matrix &>(rhs));
+            return this->eval(lhs, *rhs.matrix);
+        default:
+            typeError();
     }
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) String &lhs, __attribute__((unused)) Number &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) String &lhs, __attribute__((unused)) Number &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) String &lhs, __attribute__((unused)) Complex &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) String &lhs, __attribute__((unused)) Complex &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) String &lhs, __attribute__((unused)) List &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) String &lhs, __attribute__((unused)) List &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) String &lhs, __attribute__((unused)) ComplexList &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) String &lhs, __attribute__((unused)) ComplexList &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) String &lhs, __attribute__((unused)) String &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) String &lhs, __attribute__((unused)) String &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) String &lhs, __attribute__((unused)) Matrix &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) String &lhs, __attribute__((unused)) Matrix &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(Matrix &lhs, BaseType &rhs) {
-    switch (rhs.type()) {
+Value BinaryOperator::eval(Matrix &lhs, Value &rhs) {
+    switch (rhs.type) {
         case TypeType::NUMBER:
-            return this->eval(lhs, dynamic_cast<Number &>(rhs));
+            return this->eval(lhs, rhs.number);
         case TypeType::COMPLEX:
-            return this->eval(lhs, dynamic_cast<Complex &>(rhs));
+            return this->eval(lhs, rhs.complex);
         case TypeType::LIST:
-            return this->eval(lhs, dynamic_cast<List &>(rhs));
+            return this->eval(lhs, *rhs.list);
         case TypeType::COMPLEX_LIST:
-            return this->eval(lhs, dynamic_cast<ComplexList &>(rhs));
+            return this->eval(lhs, *rhs.complexList);
         case TypeType::STRING:
-            return this->eval(lhs, dynamic_cast<String &>(rhs));
+            return this->eval(lhs, *rhs.string);
         case TypeType::MATRIX:
-            return this->eval(lhs, dynamic_cast<Matrix &>(rhs));
+            return this->eval(lhs, *rhs.matrix);
+        default:
+            typeError();
     }
 }
-BaseType *BinaryOperator::eval(Matrix &lhs, Number &rhs) {
-    if (lhs.elements.empty()) dimensionError();
+Value BinaryOperator::eval(Matrix &lhs, Number &rhs) {
+    if (!lhs.size()) dimensionError();
 
-    auto newElements = lhs.elements;
+    Matrix *result = Matrix::create(lhs.rows, lhs.cols);
 
-    for (auto &row : newElements) {
-        for (auto &col : row) {
-            col = dynamic_cast<Number &>(*this->eval(col, rhs));
-        }
+    for (unsigned int i = 0; i < lhs.size(); i++) {
+        Number element(lhs.elements[i]);
+
+        result->elements[i] = this->eval(element, rhs).asNumber().num;
     }
 
-    return new Matrix(newElements);
+    return result;
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Complex &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Complex &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) List &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) List &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) ComplexList &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) ComplexList &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) String &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) String &rhs) {
     typeError();
 }
 
-BaseType *BinaryOperator::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Matrix &rhs) {
+Value BinaryOperator::eval(__attribute__((unused)) Matrix &lhs, __attribute__((unused)) Matrix &rhs) {
     // Binary operator with 2 matrices is only the same for + and -, all the other operators are either type error
     // or a different routine (like * and /).
     typeError();
@@ -2,11 +2,11 @@
 #define TYPES_H
 
 #include "errors.h"
-#include "TINYSTL/vector.h"
+#include "pool.h"
+#include "scratch.h"
 
 #include <cstdint>
-
-using tinystl::vector;
+#include <cstring>
 
 class UnaryOperator;
 
@@ -15,46 +15,36 @@ class BinaryOperator;
 class UnaryFunction;
 
 enum class TypeType {
-    NUMBER, COMPLEX, LIST, COMPLEX_LIST, STRING, MATRIX
+    NUMBER, COMPLEX, LIST, COMPLEX_LIST, STRING, MATRIX, NONE
 };
 
-class BaseType {
-public:
-    virtual ~BaseType() = default;
-
-    virtual char *toString() const;
-
-    virtual BaseType *eval(UnaryOperator &op) = 0;
-
-    virtual BaseType *eval(BinaryOperator &op, BaseType *rhs) = 0;
-
-    virtual BaseType *eval(UnaryFunction &func) = 0;
+// Integers up to this size are also stored as an int, so that the sum or difference of two of them still fits in 24 bits
+#define INT_NUMBER_LIMIT 0x3FFFFF
 
-    virtual TypeType type() = 0;
-};
-
-class Number : public BaseType {
+/**
+ * A real number. If it's known to be a small integer, the int is kept as well, so the common operators can use integer
+ * instructions instead of the slow soft-float routines. num is always valid, regardless of isInt.
+ */
+class Number {
 public:
     float num = 0;
+    bool isInt = false;
+    int intNum = 0;
 
     Number() = default;
 
     explicit Number(float num);
 
-    ~Number() override = default;
-
-    TypeType type() override;
+    static Number fromInt(int num);
 
-    char *toString() const override;
+    static Number fromBool(bool value);
 
-    BaseType *eval(UnaryOperator &op) override;
+    static Number exact(float num);
 
-    BaseType *eval(BinaryOperator &op, BaseType *rhs) override;
-
-    BaseType *eval(UnaryFunction &func) override;
+    char *toString() const;
 };
 
-class Complex : public BaseType {
+class Complex {
 public:
     float real = 0;
     float imag = 0;
@@ -63,200 +53,332 @@ public:
 
     Complex(float real, float imag);
 
-    ~Complex() override = default;
+    char *toString() const;
+};
 
-    TypeType type() override;
+/**
+ * Lists, matrices and strings are shared between variables and values. Each payload counts its owners and starts with
+ * a single one; retain() adds an owner and release() drops one, freeing the payload when the last owner is gone. A
+ * shared payload is read-only, anything that wants to modify it in place has to call Value::makeUnique() first.
+ * Element-wise operations get their result from createResult(), which reuses an operand that only has the value being
+ * replaced as its owner, so a chain like -(L1+1)*2 allocates a single list.
+ */
+template<typename T>
+T *retain(T *payload) {
+    payload->refCount++;
+
+    return payload;
+}
+
+template<typename T>
+void release(T *payload) {
+    if (!--payload->refCount) delete payload;
+}
+
+/**
+ * Like a matrix, a list is stored as a single block: the length, directly followed by all elements. Use create() to
+ * allocate one. The block can have room for more elements than the list has, so a list variable can grow in place.
+ */
+class List {
+public:
+    unsigned int refCount;
+    unsigned int length;
+    unsigned int capacity;      // The number of elements the block has room for
+    float elements[];
+
+    static List *create(unsigned int length);
+
+    static List *createResult(List &operand);
 
-    char *toString() const override;
+    static List *createResult(List &lhs, List &rhs);
 
-    BaseType *eval(UnaryOperator &op) override;
+    // The block is larger than sizeof(List), so take its size from the header instead of letting delete pass one
+    static void operator delete(void *ptr) {
+        scratchFree(ptr, sizeof(List) + static_cast<List *>(ptr)->capacity * sizeof(float));
+    }
 
-    BaseType *eval(BinaryOperator &op, BaseType *rhs) override;
+    List *copy() const;
 
-    BaseType *eval(UnaryFunction &func) override;
+    char *toString() const;
 };
 
-class List : public BaseType {
+/**
+ * The elements of a complex list are stored as real/imaginary pairs, so element i lives at elements[2 * i] and
+ * elements[2 * i + 1].
+ */
+class ComplexList {
 public:
-    vector<Number> elements;
+    unsigned int refCount;
+    unsigned int length;
+    unsigned int capacity;      // The number of elements the block has room for
+    float elements[];
 
-    explicit List(vector<Number> &elements);
+    static ComplexList *create(unsigned int length);
 
-    ~List() override;
+    static ComplexList *createResult(ComplexList &operand);
 
-    TypeType type() override;
+    // The block is larger than sizeof(ComplexList), so take its size from the header instead of letting delete pass one
+    static void operator delete(void *ptr) {
+        scratchFree(ptr, sizeof(ComplexList) + static_cast<ComplexList *>(ptr)->capacity * 2 * sizeof(float));
+    }
 
-    char *toString() const override;
+    ComplexList *copy() const;
 
-    BaseType *eval(UnaryOperator &op) override;
+    Complex at(unsigned int index) const;
 
-    BaseType *eval(BinaryOperator &op, BaseType *rhs) override;
+    void set(unsigned int index, const Complex &cplx);
 
-    BaseType *eval(UnaryFunction &func) override;
+    char *toString() const;
 };
 
-class ComplexList : public BaseType {
+class String {
 public:
-    vector<Complex> elements;
-
-    explicit ComplexList(const vector<Complex> &elements);
+    unsigned int refCount = 1;
+    unsigned int length;
+    char *string;
 
-    ~ComplexList() override;
+    POOL_ALLOCATED
 
-    TypeType type() override;
+    explicit String(unsigned int length, char *string);
 
-    char *toString() const override;
+    ~String();
 
-    BaseType *eval(UnaryOperator &op) override;
+    // The characters of a string are freed together with it, so they have to be allocated with this
+    static char *allocate(unsigned int length);
 
-    BaseType *eval(BinaryOperator &op, BaseType *rhs) override;
+    String *copy() const;
 
-    BaseType *eval(UnaryFunction &func) override;
+    char *toString() const;
 };
 
-class String : public BaseType {
+/**
+ * A matrix is stored as a single block: the dimensions, directly followed by all elements in row-major order. Use
+ * create() to allocate one.
+ */
+class Matrix {
 public:
-    unsigned int length;
-    char *string;
+    unsigned int refCount;
+    uint8_t rows;
+    uint8_t cols;
+    float elements[];
 
-    explicit String(unsigned int length, char *string);
+    static Matrix *create(uint8_t rows, uint8_t cols);
 
-    ~String() override;
+    static Matrix *createResult(Matrix &operand);
 
-    TypeType type() override;
+    static Matrix *createResult(Matrix &lhs, Matrix &rhs);
 
-    char *toString() const override;
+    // The block is larger than sizeof(Matrix), so take its size from the header instead of letting delete pass one
+    static void operator delete(void *ptr) {
+        scratchFree(ptr, sizeof(Matrix) + static_cast<Matrix *>(ptr)->size() * sizeof(float));
+    }
 
-    BaseType *eval(UnaryOperator &op) override;
+    Matrix *copy() const;
 
-    BaseType *eval(BinaryOperator &op, BaseType *rhs) override;
+    unsigned int size() const;
 
-    BaseType *eval(UnaryFunction &func) override;
+    float &at(uint8_t row, uint8_t col);
+
+    float at(uint8_t row, uint8_t col) const;
 };
 
-class Matrix : public BaseType {
+/**
+ * The result of evaluating an expression, which is passed around by value. Numbers and complex numbers are stored
+ * inline, so no memory is allocated for them. All other types own the object they point to, which is freed when the
+ * value goes out of scope. Values can only be moved, not copied.
+ */
+class Value {
 public:
-    vector<vector<Number>> elements;
+    TypeType type;
+    union {
+        Number number;
+        Complex complex;
+        List *list;
+        ComplexList *complexList;
+        String *string;
+        Matrix *matrix;
+    };
+
+    Value();
+
+    Value(Number number);
+
+    Value(Complex complex);
+
+    Value(List *list);
+
+    Value(ComplexList *complexList);
+
+    Value(String *string);
+
+    Value(Matrix *matrix);
+
+    // Moves, assignments and destructors happen for every value on the VM stack, so they are inline, and numbers and
+    // complex numbers never get to the out of line release
+
+    Value(Value &&other) noexcept {
+        // Copy the whole union, whichever member is the largest
+        memcpy((void *) this, (void *) &other, sizeof(Value));
+
+        other.type = TypeType::NONE;
+    }
+
+    Value(const Value &other) = delete;
+
+    ~Value() {
+        if (ownsPayload()) releasePayload();
+    }
+
+    Value &operator=(Value &&other) noexcept {
+        if (this != &other) {
+            if (ownsPayload()) releasePayload();
+            memcpy((void *) this, (void *) &other, sizeof(Value));
+
+            other.type = TypeType::NONE;
+        }
+
+        return *this;
+    }
+
+    Value &operator=(const Value &other) = delete;
+
+    // The same as assigning Value(), without the temporary
+    void clear() {
+        if (ownsPayload()) releasePayload();
+
+        type = TypeType::NONE;
+    }
+
+    char *toString() const;
+
+    Number &asNumber();
+
+    Complex &asComplex();
+
+    void makeUnique();
 
-    explicit Matrix(vector<vector<Number>> &elements);
+    void promote();
 
-    ~Matrix() override;
+    Value share() const;
 
-    TypeType type() override;
+    Value eval(UnaryOperator &op);
 
-    char *toString() const override;
+    Value eval(BinaryOperator &op, Value &rhs);
 
-    BaseType *eval(UnaryOperator &op) override;
+    Value eval(UnaryFunction &func);
 
-    BaseType *eval(BinaryOperator &op, BaseType *rhs) override;
+private:
+    bool ownsPayload() const {
+        return type != TypeType::NUMBER && type != TypeType::COMPLEX && type != TypeType::NONE;
+    }
 
-    BaseType *eval(UnaryFunction &func) override;
+    void releasePayload();
 };
 
 class UnaryOperator {
 public:
     virtual ~UnaryOperator() = default;
 
-    virtual BaseType *eval(Number &rhs);
+    virtual Value eval(Number &rhs);
 
-    virtual BaseType *eval(Complex &rhs);
+    virtual Value eval(Complex &rhs);
 
-    virtual BaseType *eval(List &rhs);
+    virtual Value eval(List &rhs);
 
-    virtual BaseType *eval(ComplexList &rhs);
+    virtual Value eval(ComplexList &rhs);
 
-    virtual BaseType *eval(String &rhs);
+    virtual Value eval(String &rhs);
 
-    virtual BaseType *eval(Matrix &rhs);
+    virtual Value eval(Matrix &rhs);
 };
 
 class BinaryOperator {
 public:
     virtual ~BinaryOperator() = default;
 
-    virtual BaseType *eval(Number &lhs, BaseType &rhs);
+    virtual Value eval(Number &lhs, Value &rhs);
 
-    virtual BaseType *eval(Number &lhs, Number &rhs);
+    virtual Value eval(Number &lhs, Number &rhs);
 
-    virtual BaseType *eval(Number &lhs, Complex &rhs);
+    virtual Value eval(Number &lhs, Complex &rhs);
 
-    virtual BaseType *eval(Number &lhs, List &rhs);
+    virtual Value eval(Number &lhs, List &rhs);
 
-    virtual BaseType *eval(Number &lhs, ComplexList &rhs);
+    virtual Value eval(Number &lhs, ComplexList &rhs);
 
-    virtual BaseType *eval(Number &lhs, String &rhs);
+    virtual Value eval(Number &lhs, String &rhs);
 
-    virtual BaseType *eval(Number &lhs, Matrix &rhs);
+    virtual Value eval(Number &lhs, Matrix &rhs);
 
-    virtual BaseType *eval(Complex &lhs, BaseType &rhs);
+    virtual Value eval(Complex &lhs, Value &rhs);
 
-    virtual BaseType *eval(Complex &lhs, Number &rhs);
+    virtual Value eval(Complex &lhs, Number &rhs);
 
-    virtual BaseType *eval(Complex &lhs, Complex &rhs);
+    virtual Value eval(Complex &lhs, Complex &rhs);
 
-    virtual BaseType *eval(Complex &lhs, List &rhs);
+    virtual Value eval(Complex &lhs, List &rhs);
 
-    virtual BaseType *eval(Complex &lhs, ComplexList &rhs);
+    virtual Value eval(Complex &lhs, ComplexList &rhs);
 
-    virtual BaseType *eval(Complex &lhs, String &rhs);
+    virtual Value eval(Complex &lhs, String &rhs);
 
-    virtual BaseType *eval(Complex &lhs, Matrix &rhs);
+    virtual Value eval(Complex &lhs, Matrix &rhs);
 
-    virtual BaseType *eval(List &lhs, BaseType &rhs);
+    virtual Value eval(List &lhs, Value &rhs);
 
-    virtual BaseType *eval(List &lhs, Number &rhs);
+    virtual Value eval(List &lhs, Number &rhs);
 
-    virtual BaseType *eval(List &lhs, Complex &rhs);
+    virtual Value eval(List &lhs, Complex &rhs);
 
-    virtual BaseType *eval(List &lhs, List &rhs);
+    virtual Value eval(List &lhs, List &rhs);
 
-    virtual BaseType *eval(List &lhs, ComplexList &rhs);
+    virtual Value eval(List &lhs, ComplexList &rhs);
 
-    virtual BaseType *eval(List &lhs, String &rhs);
+    virtual Value eval(List &lhs, String &rhs);
 
-    virtual BaseType *eval(List &lhs, Matrix &rhs);
+    virtual Value eval(List &lhs, Matrix &rhs);
 
-    virtual BaseType *eval(ComplexList &lhs, BaseType &rhs);
+    virtual Value eval(ComplexList &lhs, Value &rhs);
 
-    virtual BaseType *eval(ComplexList &lhs, Number &rhs);
+    virtual Value eval(ComplexList &lhs, Number &rhs);
 
-    virtual BaseType *eval(ComplexList &lhs, Complex &rhs);
+    virtual Value eval(ComplexList &lhs, Complex &rhs);
 
-    virtual BaseType *eval(ComplexList &lhs, List &rhs);
+    virtual Value eval(ComplexList &lhs, List &rhs);
 
-    virtual BaseType *eval(ComplexList &lhs, ComplexList &rhs);
+    virtual Value eval(ComplexList &lhs, ComplexList &rhs);
 
-    virtual BaseType *eval(ComplexList &lhs, String &rhs);
+    virtual Value eval(ComplexList &lhs, String &rhs);
 
-    virtual BaseType *eval(ComplexList &lhs, Matrix &rhs);
+    virtual Value eval(ComplexList &lhs, Matrix &rhs);
 
-    virtual BaseType *eval(String &lhs, BaseType &rhs);
+    virtual Value eval(String &lhs, Value &rhs);
 
-    virtual BaseType *eval(String &lhs, Number &rhs);
+    virtual Value eval(String &lhs, Number &rhs);
 
-    virtual BaseType *eval(String &lhs, Complex &rhs);
+    virtual Value eval(String &lhs, Complex &rhs);
 
-    virtual BaseType *eval(String &lhs, List &rhs);
+    virtual Value eval(String &lhs, List &rhs);
 
-    virtual BaseType *eval(String &lhs, ComplexList &rhs);
+    virtual Value eval(String &lhs, ComplexList &rhs);
 
-    virtual BaseType *eval(String &lhs, String &rhs);
+    virtual Value eval(String &lhs, String &rhs);
 
-    virtual BaseType *eval(String &lhs, Matrix &rhs);
+    virtual Value eval(String &lhs, Matrix &rhs);
 
-    virtual BaseType *eval(Matrix &lhs, BaseType &rhs);
+    virtual Value eval(Matrix &lhs, Value &rhs);
 
-    virtual BaseType *eval(Matrix &lhs, Number &rhs);
+    virtual Value eval(Matrix &lhs, Number &rhs);
 
-    virtual BaseType *eval(Matrix &lhs, Complex &rhs);
+    virtual Value eval(Matrix &lhs, Complex &rhs);
 
-    virtual BaseType *eval(Matrix &lhs, List &rhs);
+    virtual Value eval(Matrix &lhs, List &rhs);
 
-    virtual BaseType *eval(Matrix &lhs, ComplexList &rhs);
+    virtual Value eval(Matrix &lhs, ComplexList &rhs);
 
-    virtual BaseType *eval(Matrix &lhs, String &rhs);
+    virtual Value eval(Matrix &lhs, String &rhs);
 
-    virtual BaseType *eval(Matrix &lhs, Matrix &rhs);
+    virtual Value eval(Matrix &lhs, Matrix &rhs);
 };
 
 
@@ -1,84 +1,17 @@
 #include "utils.h"
-#include "globals.h"
 #include "types.h"
 
-#include <cmath>
 #include <cstring>
-#include <fileioc.h>
 #include <tice.h>
-#include <TINYSTL/vector.h>
 
-static int pt = 0;
-static int ct = 0;
-static int nt = -2;
+// The program is read directly from its data in RAM/flash, progPtr always points to the token after the current one
+static const uint8_t *progStart;
+static const uint8_t *progEnd;
+static const uint8_t *progPtr;
 
 extern unsigned int parseLine;
 extern unsigned int parseCol;
 
-using tinystl::vector;
-
-char *formatNum(float num) {
-    static char buf[20];
-    float absNum;
-    int exp;
-    // This is a bit different from TI-BASIC. Normally numbers up to 1e10 can be displayed without exponent, but the
-    // problem is that printf() masks the value as an int. Since integers on the ez80 can only get up to 0x7FFFFF,
-    // everything above 0x800000 gets displayed as trash. That's why numbers above 1e6 are now required to display an
-    // exponent. See https://github.com/CE-Programming/toolchain/issues/367 for more information.
-    bool needExp = (globals.normalSciEngMode != NORMAL_MODE || num > 1e6 || num < -1e6 || (num > -1e-3 && num < 1e-3 && num != 0));
-
-    // We could have used a very simple routine and let the OS handle it. Something like this would work:
-    //
-    //  real_t tmp_real = os_FloatToReal(num);
-    //  os_RealToStr(buf, &tmp_real, ...)
-    //
-    // However, testing turns out that there are huge rounding errors, so let's still use our custom routine.
-
-    // If necessary, get the right exponent and make sure the number is properly set
-    if (needExp) {
-        absNum = fabsf(num);
-
-        if (num == 0) {
-            exp = 0;
-        } else {
-            exp = (int) log10f(absNum);
-
-            if (globals.normalSciEngMode == ENG_MODE) {
-                if (exp < 0) exp -= 3;
-                exp = exp / 3 * 3;
-            }
-
-            num /= powf(10, (float)exp);
-        }
-    }
-
-    // Do format the number
-    if (globals.fixNr == 255) {
-        sprintf(buf, "%f", num);
-    } else {
-        sprintf(buf, "%10.*f", globals.fixNr, num);
-    }
-
-    // Replace minus character
-    if (*buf == '-') *buf = 0x1A;
-
-    // Strip trailing zeroes
-    char *p = buf + strlen(buf) - 1;
-    while (*p == '0' && --p > buf);
-
-    // Eventually strip decimal point too
-    if (*p == '.') p--;
-    *(p + 1) = '\0';
-
-    // Add |E<exp> to the string!
-    if (needExp) {
-        *(p + 1) = 0x1B;
-        sprintf(p + 2, "%d", exp);
-        if (exp < 0) *(p + 2) = 0x1A;
-    }
-
-    return buf;
-}
 
 bool is2ByteTok(int token) {
     uint8_t All2ByteTokens[10] = {
@@ -97,88 +30,130 @@ bool is2ByteTok(int token) {
     return memchr(All2ByteTokens, token, sizeof(All2ByteTokens)) != nullptr;
 }
 
-void seekPrev(ti_var_t slot) {
-    if (nt != EOF) {
-        ti_Seek(-1, SEEK_CUR, slot);
-    }
+void tokenInit(const uint8_t *data, unsigned int size) {
+    progStart = progPtr = data;
+    progEnd = data + size;
+}
 
-    nt = ct;
-    ct = pt;
-    pt = 0;
+void seekPrev() {
+    progPtr--;
     parseCol--;
 }
 
-int tokenNext(ti_var_t slot) {
-    if (nt == -2) {
-        nt = ti_GetC(slot);
-    }
-
-    pt = ct;
-    ct = nt;
-    nt = ti_GetC(slot);
+int tokenNext() {
     parseCol++;
 
-    return ct;
+    // Step one past the end at EOF, so that seekPrev() gets back to the last token again
+    if (progPtr >= progEnd) {
+        progPtr = progEnd + 1;
+
+        return EOF;
+    }
+
+    return *progPtr++;
 }
 
 int tokenCurrent() {
-    return ct;
+    if (progPtr == progStart || progPtr > progEnd) return EOF;
+
+    return progPtr[-1];
 }
 
 int tokenPeek() {
-    return nt;
+    if (progPtr >= progEnd) return EOF;
+
+    return *progPtr;
+}
+
+const uint8_t *tokenPtr() {
+    return progPtr;
 }
 
 bool endOfLine(int token) {
     return token == EOF || (uint8_t) token == OS_TOK_NEWLINE || (uint8_t) token == OS_TOK_COLON;
 }
 
-float cosfMode(float num) {
-    if (globals.inRadianMode) {
-        return cosf(num);
-    }
+Matrix *multiplyMatrices(Matrix &lhs, Matrix &rhs) {
+    if (!lhs.size() || !rhs.size()) dimensionError();
+    if (lhs.cols != rhs.rows) dimensionError();
 
-    return cosf(num * M_PI / 180);
-}
+    Matrix *result = Matrix::create(lhs.rows, rhs.cols);
 
-float sinfMode(float num) {
-    if (globals.inRadianMode) {
-        return sinf(num);
-    }
+    multiplyMatricesInto(*result, lhs, rhs);
 
-    return sinf(num * M_PI / 180);
+    return result;
 }
 
-float tanfMode(float num) {
-    if (globals.inRadianMode) {
-        return tanf(num);
-    }
+/**
+ * Multiplies two square matrices of a small, fixed size, which are by far the most common ones. As the size is a
+ * constant, the compiler can unroll the loops and keep the strides in the instructions. A row of the result is
+ * accumulated in sums, and only written once.
+ */
+template<uint8_t N>
+static void multiplySquare(float *out, const float *lhs, const float *rhs) {
+    for (uint8_t i = 0; i < N; i++, lhs += N, out += N) {
+        float sums[N] = {};
+        const float *rhsRow = rhs;
+
+        for (uint8_t k = 0; k < N; k++, rhsRow += N) {
+            float factor = lhs[k];
+
+            for (uint8_t j = 0; j < N; j++) {
+                sums[j] += factor * rhsRow[j];
+            }
+        }
 
-    return tanf(num * M_PI / 180);
+        for (uint8_t j = 0; j < N; j++) {
+            out[j] = sums[j];
+        }
+    }
 }
 
-float atanfMode(float num) {
-    if (globals.inRadianMode) {
-        return atanf(num);
+/**
+ * Multiplies two matrices into an existing one, which has the right dimensions already. The result can't be one of
+ * the operands, but the operands can be the same matrix.
+ *
+ * The loops are in i-k-j order: every element of the left row scales a whole row of the right matrix, which is added
+ * to the result row. This way, both matrices are read row by row, and zeros in the left matrix, which are common in
+ * geometry, skip a whole row of multiplications.
+ */
+void multiplyMatricesInto(Matrix &result, const Matrix &lhs, const Matrix &rhs) {
+    uint8_t rows = lhs.rows;
+    uint8_t inner = lhs.cols;
+    uint8_t cols = rhs.cols;
+
+    if (rows == inner && inner == cols) {
+        switch (rows) {
+            case 2:
+                multiplySquare<2>(result.elements, lhs.elements, rhs.elements);
+                return;
+            case 3:
+                multiplySquare<3>(result.elements, lhs.elements, rhs.elements);
+                return;
+            case 4:
+                multiplySquare<4>(result.elements, lhs.elements, rhs.elements);
+                return;
+            default:
+                break;
+        }
     }
 
-    return atanf(num * M_PI / 180);
-}
+    float *out = result.elements;
+    const float *lhsRow = lhs.elements;
 
-Matrix *multiplyMatrices(Matrix &lhs, Matrix &rhs) {
-    if (lhs.elements.empty()) dimensionError();
-    if (rhs.elements.empty()) dimensionError();
-    if (lhs.elements[0].size() != rhs.elements.size()) dimensionError();
+    for (uint8_t i = 0; i < rows; i++, lhsRow += inner, out += cols) {
+        const float *rhsRow = rhs.elements;
+
+        memset(out, 0, cols * sizeof(float));
 
-    vector<vector<Number>> newElements(lhs.elements.size(), vector<Number>(rhs.elements[0].size()));
+        for (uint8_t k = 0; k < inner; k++, rhsRow += cols) {
+            float factor = lhsRow[k];
 
-    for (unsigned int i = 0; i < lhs.elements.size(); i++) {
-        for (unsigned int j = 0; j < rhs.elements[0].size(); j++) {
-            for (unsigned int k = 0; k < lhs.elements[0].size(); k++) {
-                newElements[i][j].num += lhs.elements[i][k].num * rhs.elements[k][j].num;
+            if (factor == 0) continue;
+
+            for (uint8_t j = 0; j < cols; j++) {
+                out[j] += factor * rhsRow[j];
             }
         }
     }
-
-    return new Matrix(newElements);
 }
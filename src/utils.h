@@ -3,30 +3,26 @@
 
 #include "types.h"
 
-#include <fileioc.h>
-
-char *formatNum(float num);
+#include <cstdint>
 
 bool is2ByteTok(int token);
 
-void seekPrev(ti_var_t slot);
+void tokenInit(const uint8_t *data, unsigned int size);
+
+void seekPrev();
 
-int tokenNext(ti_var_t slot);
+int tokenNext();
 
 int tokenCurrent();
 
 int tokenPeek();
 
-bool endOfLine(int token);
-
-float cosfMode(float num);
+const uint8_t *tokenPtr();
 
-float sinfMode(float num);
-
-float tanfMode(float num);
-
-float atanfMode(float num);
+bool endOfLine(int token);
 
 Matrix *multiplyMatrices(Matrix &lhs, Matrix &rhs);
 
+void multiplyMatricesInto(Matrix &result, const Matrix &lhs, const Matrix &rhs);
+
 #endif
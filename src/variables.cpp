@@ -3,26 +3,29 @@
 #include "errors.h"
 
 #include <cstring>
+#include <fileioc.h>
 #include <tice.h>
-#include <TINYSTL/vector.h>
 
-struct var_real *variables[26];
+struct var_real *variables[27];   // A-Z and theta
 String *strings[10];
 String *equations[31];
 struct var_list *lists[6];
 struct var_custom_list *customLists[50];
 Matrix *matrices[10];
+Value ans;
+
+// Whether the program stored an element in the matrix, so it has to be written back to the OS
+static bool matrixDirty[10];
 
 static uint8_t custom_list_index = 0;
 
-using tinystl::vector;
 
 static void handle_real(const char *varname, void *data) {
     if (varname[0] >= OS_TOK_A && varname[0] <= OS_TOK_THETA) {
         auto real = new var_real();
 
         real->complex = false;
-        real->value.num = new Number(os_RealToFloat((real_t *) data));
+        real->value.num = Number::exact(os_RealToFloat((real_t *) data));
 
         unsigned int index = varname[0] - 'A';
         variables[index] = real;
@@ -35,22 +38,56 @@ static void handle_cplx(const char *varname, void *data) {
         auto cplx = new var_real();
 
         cplx->complex = true;
-        cplx->value.cplx = new Complex(os_RealToFloat(&oldCplx->real), os_RealToFloat(&oldCplx->imag));
+        cplx->value.cplx = Complex(os_RealToFloat(&oldCplx->real), os_RealToFloat(&oldCplx->imag));
 
         auto index = varname[0] - 'A';
         variables[index] = cplx;
     }
 }
 
-static void handle_list(const char *varname, void *data) {
-    auto oldList = (list_t *) data;
+static List *readList(const list_t *oldList) {
+    List *list = List::create(oldList->dim);
 
-    auto list_data = vector<Number>(oldList->dim);
+    for (unsigned int i = 0; i < oldList->dim; i++) {
+        list->elements[i] = os_RealToFloat(&oldList->items[i]);
+    }
+
+    return list;
+}
+
+static ComplexList *readComplexList(const cplx_list_t *oldList) {
+    ComplexList *list = ComplexList::create(oldList->dim);
 
     for (unsigned int i = 0; i < oldList->dim; i++) {
-        list_data[i] = Number(os_RealToFloat(&oldList->items[i]));
+        list->elements[2 * i] = os_RealToFloat(&oldList->items[i].real);
+        list->elements[2 * i + 1] = os_RealToFloat(&oldList->items[i].imag);
+    }
+
+    return list;
+}
+
+static Matrix *readMatrix(const matrix_t *matrix) {
+    // Both the OS and IndiumCE store the elements in row-major order
+    Matrix *result = Matrix::create(matrix->rows, matrix->cols);
+
+    for (unsigned int i = 0; i < result->size(); i++) {
+        result->elements[i] = os_RealToFloat(&matrix->items[i]);
     }
 
+    return result;
+}
+
+static String *readString(const string_t *string) {
+    auto data = String::allocate(string->len);
+
+    memcpy(data, string->data, string->len);
+
+    return new String(string->len, data);
+}
+
+static void handle_list(const char *varname, void *data) {
+    List *list_data = readList((list_t *) data);
+
     if (varname[1] >= 'A') {
         // Custom list
         if (custom_list_index == 50) parseError("Too much custom lists");
@@ -58,14 +95,14 @@ static void handle_list(const char *varname, void *data) {
         auto custom_list = new var_custom_list();
         memcpy(custom_list->name, varname + 1, 5);
         custom_list->list.complex = false;
-        custom_list->list.list.list = new List(list_data);
+        custom_list->list.list.list = list_data;
 
         customLists[custom_list_index++] = custom_list;
     } else {
         // OS list
         auto list = new var_list();
         list->complex = false;
-        list->list.list = new List(list_data);
+        list->list.list = list_data;
 
         auto index = (unsigned char) varname[1];
         lists[index] = list;
@@ -73,13 +110,7 @@ static void handle_list(const char *varname, void *data) {
 }
 
 static void handle_list_cplx(const char *varname, void *data) {
-    auto oldList = (cplx_list_t *) data;
-
-    auto list_data = vector<Complex>(oldList->dim);
-
-    for (unsigned int i = 0; i < oldList->dim; i++) {
-        list_data[i] = Complex(os_RealToFloat(&oldList->items[i].real), os_RealToFloat(&oldList->items[i].imag));
-    }
+    ComplexList *list_data = readComplexList((cplx_list_t *) data);
 
     if (varname[1] >= 'A') {
         // Custom list
@@ -88,14 +119,14 @@ static void handle_list_cplx(const char *varname, void *data) {
         auto new_list = new var_custom_list();
         memcpy(new_list->name, varname + 1, 5);
         new_list->list.complex = true;
-        new_list->list.list.complexList = new ComplexList(list_data);
+        new_list->list.list.complexList = list_data;
 
         customLists[custom_list_index++] = new_list;
     } else {
         // OS list
         auto list = new var_list();
         list->complex = true;
-        list->list.complexList = new ComplexList(list_data);
+        list->list.complexList = list_data;
 
         auto index = (unsigned char) varname[1];
         lists[index] = list;
@@ -103,36 +134,19 @@ static void handle_list_cplx(const char *varname, void *data) {
 }
 
 static void handle_matrix(const char *varname, void *data) {
-    auto matrix = (matrix_t *) data;
-
-    vector<vector<Number>> matrix_data(matrix->rows, vector<Number>(matrix->cols));
-
-    unsigned int index = 0;
-    for (uint8_t row = 0; row < matrix->rows; row++) {
-        for (uint8_t col = 0; col < matrix->cols; col++) {
-            matrix_data[row][col] = Number(os_RealToFloat(&matrix->items[index]));
-            index++;
-        }
-    }
-
-    index = (unsigned char) varname[1];
-    matrices[index] = new Matrix(matrix_data);
+    unsigned int index = (unsigned char) varname[1];
+    matrices[index] = readMatrix((matrix_t *) data);
 }
 
 static void handle_string(const char *varname, void *data) {
-    auto string = (string_t *) data;
-
-    auto string_data = new char[string->len];
-    memcpy(string_data, string->data, string->len);
-
     unsigned int index = (unsigned char) varname[1];
-    strings[index] = new String(string->len, string_data);
+    strings[index] = readString((string_t *) data);
 }
 
 static void handle_equation(const char *varname, void *data) {
     auto equation = (equ_t *) data;
 
-    auto equation_data = new char[equation->len];
+    auto equation_data = String::allocate(equation->len);
 
     memcpy(equation_data, equation->data, equation->len);
 
@@ -140,6 +154,34 @@ static void handle_equation(const char *varname, void *data) {
     equations[index] = new String(equation->len, equation_data);
 }
 
+static void handle_ans(uint24_t type, void *data) {
+    switch (type) {
+        case OS_TYPE_REAL:
+            ans = Number::exact(os_RealToFloat((real_t *) data));
+            break;
+        case OS_TYPE_CPLX: {
+            auto cplx = (cplx_t *) data;
+
+            ans = Complex(os_RealToFloat(&cplx->real), os_RealToFloat(&cplx->imag));
+            break;
+        }
+        case OS_TYPE_REAL_LIST:
+            ans = readList((list_t *) data);
+            break;
+        case OS_TYPE_CPLX_LIST:
+            ans = readComplexList((cplx_list_t *) data);
+            break;
+        case OS_TYPE_MATRIX:
+            ans = readMatrix((matrix_t *) data);
+            break;
+        case OS_TYPE_STR:
+            ans = readString((string_t *) data);
+            break;
+        default:
+            break;
+    }
+}
+
 static void handle_unimplemented(__attribute__((unused)) const char *varname, __attribute__((unused)) void *data) {}
 
 static void (*handlers[14])(const char *, void *) = {
@@ -169,12 +211,17 @@ void get_all_os_variables() {
      * After lots of debugging, I found out that ti_DetectAny( starts at the variable-length VAT, which doesn't
      * include OS vars, lists, matrices etc. So that's why we have to use a horrible custom routine to make it work!
      */
+    ans = Number::fromInt(0);
+
     void *entry = os_GetSymTablePtr();
     while ((entry = os_NextSymEntry(entry, &var_type, &name_length, varname, &data)) != nullptr) {
         varname[name_length] = '\0';
 
-        // Skip Ans, we will treat it special afterwards
-        if (varname[0] == OS_TOK_ANS) continue;
+        // Ans isn't a named variable, so it has its own handler
+        if (varname[0] == OS_TOK_ANS) {
+            handle_ans(var_type, data);
+            continue;
+        }
 
         // Get a valid handler
         if (var_type >= sizeof(handlers) / sizeof(handlers[0])) continue;
@@ -184,3 +231,325 @@ void get_all_os_variables() {
 }
 
 
+
+/**
+ * Stores a number in a real variable, which becomes complex if the number is complex
+ * @param variableNr Index of the variable, 0 for A up to 26 for theta
+ * @param value Number to store, anything else is a type error
+ */
+void storeVariable(uint8_t variableNr, const Value &value) {
+    if (value.type != TypeType::NUMBER && value.type != TypeType::COMPLEX) typeError();
+
+    struct var_real *var = variables[variableNr];
+    if (var == nullptr) var = variables[variableNr] = new var_real();
+
+    var->complex = value.type == TypeType::COMPLEX;
+    if (var->complex) var->value.cplx = value.complex;
+    else var->value.num = value.number;
+}
+
+/**
+ * Checks an index into a list or matrix, which starts at 1 like in TI-BASIC
+ * @param index Index to check, which should be an integer
+ * @param limit Largest valid index
+ * @return The index starting at 0
+ */
+static unsigned int elementIndex(const Value &index, unsigned int limit) {
+    if (index.type != TypeType::NUMBER) typeError();
+
+    const Number &number = index.number;
+
+    if (number.isInt) {
+        if (number.intNum < 1 || (unsigned int) number.intNum > limit) dimensionError();
+
+        return number.intNum - 1;
+    }
+
+    if (number.num < 1 || number.num > (float) limit || number.num != (float) (int) number.num) dimensionError();
+
+    return (unsigned int) number.num - 1;
+}
+
+/**
+ * Reads a single element of an OS list, without touching the rest of it
+ * @param listNr Index of the list, 0 for L1 up to 5 for L6
+ * @param index Index of the element, starting at 1
+ * @return The element
+ */
+Value listElement(uint8_t listNr, const Value &index) {
+    const struct var_list *var = lists[listNr];
+
+    if (var == nullptr) undefinedError();
+
+    if (var->complex) {
+        const ComplexList *list = var->list.complexList;
+
+        return list->at(elementIndex(index, list->length));
+    }
+
+    const List *list = var->list.list;
+
+    return Number::exact(list->elements[elementIndex(index, list->length)]);
+}
+
+Value matrixElement(uint8_t matrixNr, const Value &row, const Value &col) {
+    const Matrix *matrix = matrices[matrixNr];
+
+    if (matrix == nullptr) undefinedError();
+
+    return Number::exact(matrix->at(elementIndex(row, matrix->rows), elementIndex(col, matrix->cols)));
+}
+
+// Variables outlive the statement, so their payloads come from the pools instead of the scratch arena
+template<typename T>
+static T *allocatePayload(size_t size) {
+    auto payload = static_cast<T *>(poolAlloc(size));
+
+    payload->refCount = 1;
+
+    return payload;
+}
+
+/**
+ * Appending one element at a time, like For(I,1,N):X→L1(I):End does, grows a full list by half its length, so each
+ * element is only copied a few times in total instead of at every append
+ */
+static unsigned int growCapacity(unsigned int length) {
+    unsigned int capacity = length < 8 ? 8 : length + length / 2;
+
+    return capacity > MAX_LIST_LENGTH ? MAX_LIST_LENGTH : capacity;
+}
+
+/**
+ * Replaces the list of a variable by a new one which keeps the old elements. This is needed when the list outgrows its
+ * block or becomes complex, and when it's shared with another value, which shouldn't see the store.
+ */
+static void replaceList(struct var_list &var, unsigned int length, unsigned int capacity, bool complex) {
+    if (complex) {
+        auto list = allocatePayload<ComplexList>(sizeof(ComplexList) + capacity * 2 * sizeof(float));
+
+        list->length = length;
+        list->capacity = capacity;
+
+        if (var.complex) {
+            memcpy(list->elements, var.list.complexList->elements, var.list.complexList->length * 2 * sizeof(float));
+            release(var.list.complexList);
+        } else {
+            for (unsigned int i = 0; i < var.list.list->length; i++) {
+                list->set(i, Complex(var.list.list->elements[i], 0));
+            }
+            release(var.list.list);
+        }
+
+        var.list.complexList = list;
+    } else {
+        auto list = allocatePayload<List>(sizeof(List) + capacity * sizeof(float));
+
+        list->length = length;
+        list->capacity = capacity;
+        memcpy(list->elements, var.list.list->elements, var.list.list->length * sizeof(float));
+        release(var.list.list);
+
+        var.list.list = list;
+    }
+
+    var.complex = complex;
+}
+
+/**
+ * Stores a number in a single element of an OS list. Only the element is written, unless the list has to be replaced:
+ * storing just past the end appends the element, like the OS does, and a complex number makes the whole list complex.
+ * @param listNr Index of the list, 0 for L1 up to 5 for L6
+ * @param index Index of the element, starting at 1
+ * @param value Number to store, anything else is a type error
+ */
+void storeListElement(uint8_t listNr, const Value &index, const Value &value) {
+    if (value.type != TypeType::NUMBER && value.type != TypeType::COMPLEX) typeError();
+
+    struct var_list *var = lists[listNr];
+
+    // Storing the first element creates the list
+    if (var == nullptr) {
+        var = lists[listNr] = new var_list();
+        var->complex = false;
+        var->list.list = allocatePayload<List>(sizeof(List));
+        var->list.list->length = var->list.list->capacity = 0;
+    }
+
+    unsigned int length = var->complex ? var->list.complexList->length : var->list.list->length;
+    unsigned int capacity = var->complex ? var->list.complexList->capacity : var->list.list->capacity;
+    unsigned int refCount = var->complex ? var->list.complexList->refCount : var->list.list->refCount;
+    unsigned int element = elementIndex(index, length < MAX_LIST_LENGTH ? length + 1 : length);
+    bool complex = var->complex || value.type == TypeType::COMPLEX;
+    bool append = element == length;
+
+    if ((append && length == capacity) || complex != var->complex || refCount > 1) {
+        replaceList(*var, append ? length + 1 : length, append ? growCapacity(length + 1) : length, complex);
+    } else if (append) {
+        // There's room left in the block, and nobody else sees the list
+        if (complex) var->list.complexList->length++;
+        else var->list.list->length++;
+    }
+
+    var->dirty = true;
+
+    if (!complex) {
+        var->list.list->elements[element] = value.number.num;
+    } else if (value.type == TypeType::COMPLEX) {
+        var->list.complexList->set(element, value.complex);
+    } else {
+        var->list.complexList->set(element, Complex(value.number.num, 0));
+    }
+}
+
+void storeMatrixElement(uint8_t matrixNr, const Value &row, const Value &col, const Value &value) {
+    if (value.type != TypeType::NUMBER) typeError();
+
+    Matrix *matrix = matrices[matrixNr];
+
+    if (matrix == nullptr) undefinedError();
+
+    unsigned int rowIndex = elementIndex(row, matrix->rows);
+    unsigned int colIndex = elementIndex(col, matrix->cols);
+
+    // Another value still has the old matrix, so it gets its own copy
+    if (matrix->refCount > 1) {
+        size_t size = sizeof(Matrix) + matrix->size() * sizeof(float);
+        auto unique = allocatePayload<Matrix>(size);
+
+        memcpy(unique, matrix, size);
+        unique->refCount = 1;
+        release(matrix);
+
+        matrix = matrices[matrixNr] = unique;
+    }
+
+    matrix->at(rowIndex, colIndex) = value.number.num;
+    matrixDirty[matrixNr] = true;
+}
+
+/**
+ * Stores the result of an expression statement in Ans. The value is moved, so the payload of a list or matrix is
+ * handed over as is; it's only copied if it's a temporary in the scratch arena, which it would otherwise keep in use.
+ * @param value The result, which is empty afterwards
+ */
+void storeAns(Value &value) {
+    ans = static_cast<Value &&>(value);
+    ans.promote();
+}
+
+// Values in a complex variable have the complex type in the first byte of both parts
+static cplx_t toComplex(const Complex &cplx) {
+    cplx_t result;
+
+    result.real = os_FloatToReal(cplx.real);
+    result.imag = os_FloatToReal(cplx.imag);
+    result.real.sign |= OS_TYPE_CPLX;
+    result.imag.sign |= OS_TYPE_CPLX;
+
+    return result;
+}
+
+// The OS wants its own copy of the elements, which is only needed while writing the variable
+static void writeList(const char *name, const List &list) {
+    auto data = static_cast<list_t *>(operator new(sizeof(list_t) + list.length * sizeof(real_t)));
+
+    data->dim = list.length;
+    for (unsigned int i = 0; i < list.length; i++) {
+        data->items[i] = os_FloatToReal(list.elements[i]);
+    }
+
+    ti_SetVar(OS_TYPE_REAL_LIST, name, data);
+    operator delete(data);
+}
+
+static void writeComplexList(const char *name, const ComplexList &list) {
+    auto data = static_cast<cplx_list_t *>(operator new(sizeof(cplx_list_t) + list.length * sizeof(cplx_t)));
+
+    data->dim = list.length;
+    for (unsigned int i = 0; i < list.length; i++) {
+        data->items[i] = toComplex(list.at(i));
+    }
+
+    ti_SetVar(OS_TYPE_CPLX_LIST, name, data);
+    operator delete(data);
+}
+
+static void writeMatrix(const char *name, const Matrix &matrix) {
+    auto data = static_cast<matrix_t *>(operator new(sizeof(matrix_t) + matrix.size() * sizeof(real_t)));
+
+    data->rows = matrix.rows;
+    data->cols = matrix.cols;
+    for (unsigned int i = 0; i < matrix.size(); i++) {
+        data->items[i] = os_FloatToReal(matrix.elements[i]);
+    }
+
+    ti_SetVar(OS_TYPE_MATRIX, name, data);
+    operator delete(data);
+}
+
+/**
+ * Writes Ans back to the OS when the program has finished, like the OS itself does after running a program
+ */
+void writeAnsToOS() {
+    switch (ans.type) {
+        case TypeType::NUMBER: {
+            real_t real = os_FloatToReal(ans.number.num);
+
+            ti_SetVar(OS_TYPE_REAL, OS_VAR_ANS, &real);
+            break;
+        }
+        case TypeType::COMPLEX: {
+            cplx_t cplx = toComplex(ans.complex);
+
+            ti_SetVar(OS_TYPE_CPLX, OS_VAR_ANS, &cplx);
+            break;
+        }
+        case TypeType::LIST:
+            writeList(OS_VAR_ANS, *ans.list);
+            break;
+        case TypeType::COMPLEX_LIST:
+            writeComplexList(OS_VAR_ANS, *ans.complexList);
+            break;
+        case TypeType::MATRIX:
+            writeMatrix(OS_VAR_ANS, *ans.matrix);
+            break;
+        case TypeType::STRING: {
+            auto string = static_cast<string_t *>(operator new(sizeof(string_t) + ans.string->length));
+
+            string->len = ans.string->length;
+            memcpy(string->data, ans.string->string, ans.string->length);
+
+            ti_SetVar(OS_TYPE_STR, OS_VAR_ANS, string);
+            operator delete(string);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+/**
+ * Writes the OS lists and matrices that the program stored elements in back to the OS. The program works on its own
+ * copies of them, so without this the stores would be lost when it finishes.
+ */
+void writeVariablesToOS() {
+    for (uint8_t i = 0; i < 6; i++) {
+        const struct var_list *var = lists[i];
+
+        if (var == nullptr || !var->dirty) continue;
+
+        const char name[] = {OS_TOK_LIST, (char) i, 0};
+
+        if (var->complex) writeComplexList(name, *var->list.complexList);
+        else writeList(name, *var->list.list);
+    }
+
+    for (uint8_t i = 0; i < 10; i++) {
+        if (!matrixDirty[i]) continue;
+
+        const char name[] = {OS_TOK_MATRIX, (char) i, 0};
+
+        writeMatrix(name, *matrices[i]);
+    }
+}
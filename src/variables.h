@@ -3,23 +3,36 @@
 
 #include "types.h"
 
+// The number is stored in the variable itself, so its address never changes once the variable exists
 struct var_real {
+    POOL_ALLOCATED
+
     bool complex;
     union value_t {
-        Number *num;
-        Complex *cplx;
+        Number num;
+        Complex cplx;
+
+        value_t() : cplx() {}
     } value;
 };
 
 struct var_list {
+    POOL_ALLOCATED
+
     bool complex;
+    bool dirty;         // An element was stored, so the list has to be written back to the OS
     union list_t {
         List *list;
         ComplexList *complexList;
     } list;
 };
 
+// Like the OS, a list can't grow beyond this many elements
+#define MAX_LIST_LENGTH 999
+
 struct var_custom_list {
+    POOL_ALLOCATED
+
     char name[5];
     struct var_list list;
 };
@@ -29,13 +42,30 @@ struct var_string {
     char data[1];
 };
 
-extern struct var_real *variables[26];
+extern struct var_real *variables[27];
 extern String *strings[10];
 extern String *equations[31];
 extern struct var_list *lists[6];
 extern struct var_custom_list *customLists[50];
 extern Matrix *matrices[10];
+extern Value ans;
 
 void get_all_os_variables();
 
+void storeVariable(uint8_t variableNr, const Value &value);
+
+Value listElement(uint8_t listNr, const Value &index);
+
+Value matrixElement(uint8_t matrixNr, const Value &row, const Value &col);
+
+void storeListElement(uint8_t listNr, const Value &index, const Value &value);
+
+void storeMatrixElement(uint8_t matrixNr, const Value &row, const Value &col, const Value &value);
+
+void storeAns(Value &value);
+
+void writeAnsToOS();
+
+void writeVariablesToOS();
+
 #endif